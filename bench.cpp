@@ -0,0 +1,359 @@
+#include "physics.h"
+#include "queries.h"
+#include "characters.h"
+#include "rollback.h"
+#include "simplex.h"
+#include "jobs.h"
+#include "cfg.h"
+#include "sys.h"
+
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <fstream>
+#include <functional>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <numeric>
+#include <fmt/format.h>
+
+namespace cw::physics {
+	void initialize();
+	void shutdown();
+	void step(const double &delta);
+}
+
+namespace cw::bench {
+	struct scenario {
+		std::string name;
+		std::function<void(std::mt19937 &random)> build;
+	};
+	std::filesystem::path binary_path;
+	const double fixed_step_time_delta = 1. / 60;
+	std::vector<btCollisionShape *> shapes;
+	std::vector<btRigidBody *> bodies;
+	std::vector<btTriangleIndexVertexArray *> meshes;
+	std::vector<std::vector<float>> mesh_vertices;
+	std::vector<std::vector<int>> mesh_indices;
+	characters::set characters;
+	btRigidBody *add_body(btCollisionShape *shape, const glm::vec3 &location, float mass, const glm::vec3 &velocity = glm::vec3(0));
+	void clear_world();
+	void build_terrain_floor(int cells, float cell_size);
+	void build_box_field(size_t num_boxes, std::mt19937 &random);
+	void build_falling_boxes(size_t num_boxes, std::mt19937 &random);
+	void build_debris_burst(size_t num_pieces, const glm::vec3 &center, std::mt19937 &random);
+	void build_characters(size_t num_characters, std::mt19937 &random);
+	void build_catastrophe(int slab_size, size_t num_falling);
+	nlohmann::json summarize(std::vector<double> samples);
+	nlohmann::json run_scenario(const scenario &target, size_t num_steps);
+	nlohmann::json run_queries(size_t num_rays, size_t num_iterations);
+	nlohmann::json run_rollback(size_t rollback_depth, size_t num_iterations);
+}
+
+std::filesystem::path cw::sys::bin_path() {
+	return bench::binary_path;
+}
+
+btRigidBody *cw::bench::add_body(btCollisionShape *shape, const glm::vec3 &location, float mass, const glm::vec3 &velocity) {
+	btTransform transform;
+	transform.setIdentity();
+	transform.setOrigin(physics::to(location));
+	btVector3 local_inertia(0, 0, 0);
+	if (mass > 0) shape->calculateLocalInertia(mass, local_inertia);
+	auto body = new btRigidBody(mass, new btDefaultMotionState(transform), shape, local_inertia);
+	if (mass > 0) body->setLinearVelocity(physics::to(velocity));
+	physics::dynamics_world->addRigidBody(body);
+	bodies.push_back(body);
+	return body;
+}
+
+void cw::bench::clear_world() {
+	characters::clear(characters);
+	for (auto body : bodies) {
+		physics::dynamics_world->removeRigidBody(body);
+		delete body->getMotionState();
+		delete body;
+	}
+	for (auto shape : shapes) delete shape;
+	for (auto mesh : meshes) delete mesh;
+	bodies.clear();
+	shapes.clear();
+	meshes.clear();
+	mesh_vertices.clear();
+	mesh_indices.clear();
+}
+
+// Rolling simplex terrain as a BVH triangle mesh, the same shape type cooked props collide with.
+void cw::bench::build_terrain_floor(int cells, float cell_size) {
+	mesh_vertices.emplace_back();
+	mesh_indices.emplace_back();
+	auto &vertices = mesh_vertices.back();
+	auto &indices = mesh_indices.back();
+	const float half_extent = cells * cell_size * 0.5f;
+	for (int y = 0; y <= cells; y++) {
+		for (int x = 0; x <= cells; x++) {
+			glm::vec3 point(x * cell_size - half_extent, y * cell_size - half_extent, 0);
+			point.z = simplex::fractal(3, point.x * 0.02f, point.y * 0.02f) * 3.0f;
+			auto converted = physics::to(point);
+			vertices.insert(vertices.end(), { converted.x(), converted.y(), converted.z() });
+		}
+	}
+	for (int y = 0; y < cells; y++) {
+		for (int x = 0; x < cells; x++) {
+			const int corner = y * (cells + 1) + x;
+			indices.insert(indices.end(), { corner, corner + 1, corner + cells + 1, corner + 1, corner + cells + 2, corner + cells + 1 });
+		}
+	}
+	auto mesh = new btTriangleIndexVertexArray(static_cast<int>(indices.size() / 3), indices.data(), sizeof(int) * 3, static_cast<int>(vertices.size() / 3), vertices.data(), sizeof(float) * 3);
+	meshes.push_back(mesh);
+	shapes.push_back(new btBvhTriangleMeshShape(mesh, true));
+	add_body(shapes.back(), { 0, 0, 0 }, 0);
+}
+
+void cw::bench::build_box_field(size_t num_boxes, std::mt19937 &random) {
+	shapes.push_back(new btBoxShape({ 200, 1, 200 }));
+	add_body(shapes.back(), { 0, 0, -1 }, 0);
+	shapes.push_back(new btBoxShape({ 0.5f, 0.5f, 0.5f }));
+	auto box_shape = shapes.back();
+	std::uniform_real_distribution<float> spread(-100, 100), height(0.5f, 20);
+	for (size_t i = 0; i < num_boxes; i++) add_body(box_shape, { spread(random), spread(random), height(random) }, 0);
+}
+
+void cw::bench::build_falling_boxes(size_t num_boxes, std::mt19937 &random) {
+	shapes.push_back(new btBoxShape({ 0.5f, 0.5f, 0.5f }));
+	auto box_shape = shapes.back();
+	std::uniform_real_distribution<float> spread(-30, 30), height(10, 60);
+	for (size_t i = 0; i < num_boxes; i++) add_body(box_shape, { spread(random), spread(random), height(random) }, 1);
+}
+
+// Small fragments thrown outwards from one point, like a grenade going off.
+void cw::bench::build_debris_burst(size_t num_pieces, const glm::vec3 &center, std::mt19937 &random) {
+	shapes.push_back(new btBoxShape({ 0.15f, 0.1f, 0.05f }));
+	auto fragment_shape = shapes.back();
+	std::uniform_real_distribution<float> direction(-1, 1), speed(5, 25);
+	for (size_t i = 0; i < num_pieces; i++) {
+		glm::vec3 outwards(direction(random), direction(random), std::abs(direction(random)) + 0.2f);
+		outwards = glm::normalize(outwards);
+		add_body(fragment_shape, center + outwards * 0.5f, 0.1f, outwards * speed(random));
+	}
+}
+
+void cw::bench::build_characters(size_t num_characters, std::mt19937 &random) {
+	characters.world = physics::dynamics_world;
+	std::uniform_real_distribution<float> spread(-50, 50), yaw(0, 360), input(-1, 1);
+	for (size_t i = 0; i < num_characters; i++) {
+		auto index = characters::create(characters, { spread(random), spread(random), 8 });
+		characters.yaw_input[index] = yaw(random);
+		characters.movement_input[index] = { input(random), input(random) };
+	}
+}
+
+// The "physics catastrophe" from the alpha: a static slab of voxel boxes in one compound shape, with
+// continuous collision detection boxes dropped on it from high up.
+void cw::bench::build_catastrophe(int slab_size, size_t num_falling) {
+	auto compound = new btCompoundShape;
+	shapes.push_back(compound);
+	shapes.push_back(new btBoxShape({ 0.5f, 0.5f, 0.5f }));
+	auto box_shape = shapes.back();
+	btTransform transform;
+	transform.setIdentity();
+	for (int y = 0; y < slab_size; y++) {
+		for (int x = 0; x < slab_size; x++) {
+			transform.setOrigin(physics::to(glm::vec3(x - slab_size / 2, y - slab_size / 2, 0)));
+			compound->addChildShape(transform, box_shape);
+		}
+	}
+	add_body(compound, { 0, 0, 0 }, 0);
+	for (size_t i = 0; i < num_falling; i++) {
+		auto falling_object = add_body(box_shape, { (i % 8) - 4.f, (i / 8 % 8) - 4.f, 100.f + i / 64 * 2 }, 1);
+		btVector3 min, max;
+		falling_object->getAabb(min, max);
+		auto extent = std::max(std::max(max.x() - min.x(), max.y() - min.y()), max.z() - min.z());
+		falling_object->setCcdMotionThreshold(0.01);
+		falling_object->setCcdSweptSphereRadius(extent * 0.5);
+	}
+}
+
+nlohmann::json cw::bench::summarize(std::vector<double> samples) {
+	if (samples.empty()) return nullptr;
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&samples](double fraction) {
+		return samples[std::min(samples.size() - 1, static_cast<size_t>(fraction * samples.size()))];
+	};
+	return {
+		{ "mean", std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size() },
+		{ "p50", percentile(0.5) },
+		{ "p90", percentile(0.9) },
+		{ "p99", percentile(0.99) },
+		{ "max", samples.back() }
+	};
+}
+
+nlohmann::json cw::bench::run_scenario(const scenario &target, size_t num_steps) {
+	physics::initialize();
+	std::mt19937 random(1337);
+	target.build(random);
+	std::vector<double> step_ms, pairs, manifolds;
+	for (size_t i = 0; i < num_steps; i++) {
+		auto start = std::chrono::steady_clock::now();
+		physics::step(fixed_step_time_delta);
+		characters::step(characters, fixed_step_time_delta);
+		step_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		pairs.push_back(physics::dynamics_world->getBroadphase()->getOverlappingPairCache()->getNumOverlappingPairs());
+		manifolds.push_back(physics::dynamics_world->getDispatcher()->getNumManifolds());
+	}
+	nlohmann::json result = {
+		{ "name", target.name },
+		{ "steps", num_steps },
+		{ "bodies", bodies.size() },
+		{ "characters", characters.size() },
+		{ "configured_solver_iterations", physics::dynamics_world->getSolverInfo().m_numIterations },
+		{ "step_ms", summarize(step_ms) },
+		{ "broadphase_pairs", summarize(pairs) },
+		{ "contact_manifolds", summarize(manifolds) }
+	};
+	std::cerr << fmt::format("Scenario \"{}\": p50 {:.3f} ms, p99 {:.3f} ms.", target.name, result["step_ms"]["p50"].get<double>(), result["step_ms"]["p99"].get<double>()) << std::endl;
+	clear_world();
+	physics::shutdown();
+	return result;
+}
+
+nlohmann::json cw::bench::run_queries(size_t num_rays, size_t num_iterations) {
+	physics::initialize();
+	std::mt19937 random(1337);
+	build_box_field(4000, random);
+	physics::step(fixed_step_time_delta);
+	std::uniform_real_distribution<float> spread(-100, 100), height(1, 30);
+	queries::ray_batch batch;
+	for (size_t i = 0; i < num_rays; i++) {
+		glm::vec3 from { spread(random), spread(random), height(random) };
+		glm::vec3 to { spread(random), spread(random), -2 };
+		batch.add(from, to);
+	}
+	std::vector<double> sequential_samples, batched_samples;
+	size_t sequential_hits = 0, batched_hits = 0;
+	queries::results results;
+	for (size_t iteration = 0; iteration < num_iterations; iteration++) {
+		auto start = std::chrono::steady_clock::now();
+		sequential_hits = 0;
+		for (size_t i = 0; i < batch.size(); i++) {
+			auto from = physics::to(batch.from[i]), to = physics::to(batch.to[i]);
+			btCollisionWorld::ClosestRayResultCallback callback(from, to);
+			physics::dynamics_world->rayTest(from, to, callback);
+			sequential_hits += callback.hasHit();
+		}
+		sequential_samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		start = std::chrono::steady_clock::now();
+		queries::cast_rays(physics::dynamics_world, batch, results);
+		batched_samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		batched_hits = std::count(results.hit.begin(), results.hit.end(), 1);
+	}
+	nlohmann::json result = {
+		{ "rays", num_rays },
+		{ "bodies", bodies.size() },
+		{ "sequential_ms", summarize(sequential_samples) },
+		{ "batched_ms", summarize(batched_samples) },
+		{ "sequential_hits", sequential_hits },
+		{ "batched_hits", batched_hits }
+	};
+	std::cerr << fmt::format("Ray queries: sequential {:.3f} ms, batched {:.3f} ms.", result["sequential_ms"]["p50"].get<double>(), result["batched_ms"]["p50"].get<double>()) << std::endl;
+	if (sequential_hits != batched_hits) std::cerr << "Hit counts differ between sequential and batched queries!" << std::endl;
+	clear_world();
+	physics::shutdown();
+	return result;
+}
+
+// Measures how many ticks can be rewound and replayed inside one 60 Hz frame on a busy world.
+nlohmann::json cw::bench::run_rollback(size_t rollback_depth, size_t num_iterations) {
+	physics::initialize();
+	std::mt19937 random(1337);
+	build_terrain_floor(128, 1);
+	build_falling_boxes(1000, random);
+	build_characters(64, random);
+	rollback::history history;
+	rollback::reserve(history, rollback_depth + 1);
+	uint64_t tick = 0;
+	auto step = [](uint64_t) {
+		physics::step(fixed_step_time_delta);
+		characters::step(characters, fixed_step_time_delta);
+	};
+	std::vector<double> capture_us, restore_us, step_ms;
+	for (size_t i = 0; i < rollback_depth + num_iterations; i++) {
+		auto start = std::chrono::steady_clock::now();
+		step(++tick);
+		step_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		start = std::chrono::steady_clock::now();
+		rollback::capture(history, tick, physics::dynamics_world, characters);
+		capture_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+		if (tick <= rollback_depth) continue;
+		start = std::chrono::steady_clock::now();
+		rollback::restore(history, tick - rollback_depth, physics::dynamics_world, characters);
+		restore_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+		for (uint64_t replayed = tick - rollback_depth + 1; replayed <= tick; replayed++) {
+			step(replayed);
+			rollback::capture(history, replayed, physics::dynamics_world, characters);
+		}
+	}
+	const double frame_ms = 1000. / 60;
+	auto step_summary = summarize(step_ms), restore_summary = summarize(restore_us), capture_summary = summarize(capture_us);
+	const double per_step_ms = step_summary["p50"].get<double>() + capture_summary["p50"].get<double>() / 1000;
+	nlohmann::json result = {
+		{ "bodies", bodies.size() },
+		{ "characters", characters.size() },
+		{ "snapshot_bytes", history.slots[tick % history.slots.size()].size() },
+		{ "capture_us", capture_summary },
+		{ "restore_us", restore_summary },
+		{ "step_ms", step_summary },
+		{ "rollback_steps_per_frame", per_step_ms > 0 ? static_cast<int>((frame_ms - restore_summary["p50"].get<double>() / 1000) / per_step_ms) : 0 }
+	};
+	std::cerr << fmt::format("Rollback: capture {:.1f} us, restore {:.1f} us, {} steps fit in one frame.", capture_summary["p50"].get<double>(), restore_summary["p50"].get<double>(), result["rollback_steps_per_frame"].get<int>()) << std::endl;
+	clear_world();
+	physics::shutdown();
+	return result;
+}
+
+int main(int c, char **v) {
+	cw::bench::binary_path = std::filesystem::path(v[0]).remove_filename();
+	// The report may go to stdout, so everything the job system and physics print goes to stderr until it's written.
+	auto stdout_buffer = std::cout.rdbuf(std::cerr.rdbuf());
+	size_t num_steps = 600;
+	size_t num_rays = 20000;
+	std::string output_path;
+	std::vector<std::string> selected;
+	for (int i = 1; i < c; i++) {
+		std::string argument = v[i];
+		if (argument == "--steps" && i + 1 < c) num_steps = std::stoul(v[++i]);
+		else if (argument == "--rays" && i + 1 < c) num_rays = std::stoul(v[++i]);
+		else if (argument == "--threads" && i + 1 < c) cw::cfg["system"]["physics_threads"] = std::stoi(v[++i]);
+		else if (argument == "--out" && i + 1 < c) output_path = v[++i];
+		else selected.push_back(argument);
+	}
+	const std::vector<cw::bench::scenario> scenarios = {
+		{ "characters", [](std::mt19937 &random) { cw::bench::build_terrain_floor(128, 1); cw::bench::build_characters(64, random); } },
+		{ "falling_boxes", [](std::mt19937 &random) { cw::bench::build_terrain_floor(128, 1); cw::bench::build_falling_boxes(2000, random); } },
+		{ "debris_burst", [](std::mt19937 &random) { cw::bench::build_terrain_floor(128, 1); cw::bench::build_debris_burst(500, { 0, 0, 4 }, random); } },
+		{ "catastrophe", [](std::mt19937 &random) { cw::bench::build_catastrophe(100, 256); } }
+	};
+	auto wanted = [&selected](const std::string &name) {
+		return selected.empty() || std::find(selected.begin(), selected.end(), name) != selected.end();
+	};
+	cw::jobs::initialize();
+	nlohmann::json report;
+	report["job_workers"] = cw::jobs::num_workers();
+	report["scenarios"] = nlohmann::json::array();
+	for (auto &scenario : scenarios) if (wanted(scenario.name)) report["scenarios"].push_back(cw::bench::run_scenario(scenario, num_steps));
+	if (wanted("queries")) report["queries"] = cw::bench::run_queries(num_rays, 10);
+	if (wanted("rollback")) report["rollback"] = cw::bench::run_rollback(8, 60);
+	report["physics_threads"] = cw::cfg["system"]["physics_threads"];
+	cw::jobs::shutdown();
+	auto content = report.dump(1, '\t');
+	std::cout.rdbuf(stdout_buffer);
+	if (output_path.empty()) std::cout << content << std::endl;
+	else if (std::ofstream out(output_path); out.is_open()) out << content << std::endl;
+	else {
+		std::cerr << "Failed to open benchmark report for writing: " << output_path << std::endl;
+		return 1;
+	}
+	return 0;
+}
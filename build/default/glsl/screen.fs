@@ -3,10 +3,11 @@
 layout (binding=0) uniform sampler2D deferred_surface_buffer;
 layout (binding=1) uniform sampler2D deferred_position_buffer;
 layout (binding=2) uniform sampler2D deferred_material_buffer;
-layout (binding=3) uniform sampler2DArray x256_array;
-layout (binding=4) uniform sampler2DArray x512_array;
-layout (binding=5) uniform sampler2DArray x1024_array;
-layout (binding=6) uniform sampler2D sun_shadow_map;
+layout (binding=3) uniform sampler2DArray texture_pool;
+layout (binding=4) uniform sampler2D sun_shadow_map;
+layout (std430, binding=0) readonly buffer texture_pool_transforms {
+	vec4 texture_transforms[];
+};
 
 uniform float pixel_w;
 uniform float pixel_h;
@@ -23,6 +24,14 @@ out vec4 final_color;
 
 {{{ MATERIAL RESOLVER CODE}}}
 
+vec3 resolve_texture_diffuse(float texture_id, vec2 uv, vec3 fallback) {
+	int slot = int(texture_id) * 2;
+	vec4 placement = texture_transforms[slot];
+	float layer = texture_transforms[slot + 1].x;
+	if (layer < 0) return fallback;
+	return texture(texture_pool, vec3(fract(uv) * placement.xy + placement.zw, layer)).rgb;
+}
+
 float get_depth(vec2 uv) {
 	vec4 material_coords = texture2D(deferred_material_buffer, uv);
 	if (material_coords.a == 0) return far_plane;
@@ -265,8 +274,8 @@ vec3 get_diffuse(vec2 uv) {
 	} else light_power = (0.7 + (light_dot * 2.0));
 	//
 	vec3 texture_color;
-	if (material_coords.a == 80000) texture_color = texture(x1024_array, material_coords.rgb).rgb;
-	else texture_color = resolve_material_diffuse(material_coords.a);
+	texture_color = resolve_material_diffuse(material_coords.a);
+	if (material_coords.b > 0) texture_color = resolve_texture_diffuse(material_coords.b, material_coords.rg, texture_color);
 	return contrastSaturationBrightness(vec4(texture_color, 1), light_power, saturation_power, 1.0).rgb;
 }
 
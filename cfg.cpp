@@ -19,7 +19,7 @@ void cw::load_cfg() {
 		if (file.path().extension().string() != ".json") continue;
 		auto section = file.path().stem().string();
 		std::cout << "Loading configuration section: \"" << section << "\"" << std::endl;
-		auto content = misc::read_file(file.path().string());
+		auto content = misc::map_file(file.path(), misc::access::sequential);
 		if (!content) continue;
 		cfg[section] = nlohmann::json::parse(content->begin(), content->end());
 	}
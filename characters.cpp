@@ -0,0 +1,141 @@
+#include "characters.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+
+namespace cw::characters {
+	const float hover_height = 2.5f;
+	const float hover_stiffness = 10.0f;
+	const float walk_speed = 10.0f;
+	const float skin_width = 0.01f;
+	const int slide_iterations = 2;
+	template <typename T> void swap_remove(std::vector<T> &target, size_t index);
+	glm::vec3 walk_velocity(const glm::vec2 &input, float yaw);
+	void sweep_and_slide(set &target);
+}
+
+template <typename T> void cw::characters::swap_remove(std::vector<T> &target, size_t index) {
+	target[index] = target.back();
+	target.pop_back();
+}
+
+size_t cw::characters::create(set &target, const glm::vec3 &location, float radius, float height) {
+	assert(target.world);
+	auto shape = new btCapsuleShape(radius, height);
+	auto object = new btCollisionObject;
+	btTransform transform;
+	transform.setIdentity();
+	transform.setOrigin(physics::to(location));
+	object->setCollisionShape(shape);
+	object->setWorldTransform(transform);
+	object->setCollisionFlags(object->getCollisionFlags() | btCollisionObject::CF_KINEMATIC_OBJECT);
+	object->setActivationState(DISABLE_DEACTIVATION);
+	target.world->addCollisionObject(object, collision_group, collision_mask);
+	target.location.push_back(location);
+	target.velocity.push_back({ 0, 0, 0 });
+	target.radius.push_back(radius);
+	target.height.push_back(height);
+	target.grounded.push_back(false);
+	target.movement_input.push_back({ 0, 0 });
+	target.yaw_input.push_back(0);
+	target.shape.push_back(shape);
+	target.object.push_back(object);
+	return target.size() - 1;
+}
+
+// The last character is moved into the freed slot, so its index changes to `index`.
+void cw::characters::destroy(set &target, size_t index) {
+	assert(index < target.size());
+	target.world->removeCollisionObject(target.object[index]);
+	delete target.object[index];
+	delete target.shape[index];
+	swap_remove(target.location, index);
+	swap_remove(target.velocity, index);
+	swap_remove(target.radius, index);
+	swap_remove(target.height, index);
+	swap_remove(target.grounded, index);
+	swap_remove(target.movement_input, index);
+	swap_remove(target.yaw_input, index);
+	swap_remove(target.shape, index);
+	swap_remove(target.object, index);
+}
+
+void cw::characters::clear(set &target) {
+	while (target.size()) destroy(target, target.size() - 1);
+}
+
+glm::vec3 cw::characters::walk_velocity(const glm::vec2 &input, float yaw) {
+	if (!input.x && !input.y) return { 0, 0, 0 };
+	glm::vec3 direction = glm::vec4(glm::normalize(input) * walk_speed, 0, 0) * glm::rotate(glm::radians(yaw), glm::vec3(0, 0, 1));
+	return { direction.x, direction.y, 0 };
+}
+
+void cw::characters::sweep_and_slide(set &target) {
+	auto &motion = target.motion;
+	for (int iteration = 0; iteration < slide_iterations; iteration++) {
+		target.sweeps.clear();
+		target.sweep_owners.clear();
+		for (size_t i = 0; i < target.size(); i++) {
+			if (glm::dot(motion[i], motion[i]) < 1e-8f) continue;
+			target.sweeps.add(target.shape[i], target.location[i], target.location[i] + motion[i], collision_group, collision_mask, target.object[i]);
+			target.sweep_owners.push_back(i);
+		}
+		if (!target.sweeps.size()) break;
+		queries::cast_sweeps(target.world, target.sweeps, target.sweep_results);
+		for (size_t j = 0; j < target.sweep_owners.size(); j++) {
+			const size_t i = target.sweep_owners[j];
+			if (!target.sweep_results.hit[j]) {
+				target.location[i] += motion[i];
+				motion[i] = { 0, 0, 0 };
+				continue;
+			}
+			// Stop just short of the contact, then slide whatever motion is left along the surface.
+			const float fraction = std::max(0.0f, target.sweep_results.fraction[j] - skin_width / glm::length(motion[i]));
+			const auto normal = target.sweep_results.normal[j];
+			target.location[i] += motion[i] * fraction;
+			auto remaining = motion[i] * (1 - fraction);
+			motion[i] = remaining - normal * glm::dot(remaining, normal);
+			if (auto into_surface = glm::dot(target.velocity[i], normal); into_surface < 0) target.velocity[i] -= normal * into_surface;
+		}
+	}
+}
+
+void cw::characters::step(set &target, float delta) {
+	const size_t num_characters = target.size();
+	if (!num_characters) return;
+	target.ground_probes.clear();
+	for (size_t i = 0; i < num_characters; i++) {
+		target.ground_probes.add(target.location[i], target.location[i] - glm::vec3(0, 0, hover_height), collision_group, collision_mask, target.object[i]);
+	}
+	queries::cast_rays(target.world, target.ground_probes, target.ground_results);
+	auto &motion = target.motion;
+	motion.resize(num_characters);
+	for (size_t i = 0; i < num_characters; i++) {
+		target.grounded[i] = target.ground_results.hit[i];
+		if (target.grounded[i]) {
+			// Grounded characters hover at a fixed height on a stiff spring and walk at a constant speed.
+			auto walk = walk_velocity(target.movement_input[i], target.yaw_input[i]);
+			float correction = (hover_height - (target.location[i].z - target.ground_results.point[i].z)) * hover_stiffness;
+			target.velocity[i] = { walk.x, walk.y, glm::mix(target.velocity[i].z, correction, 0.99f) };
+		} else target.velocity[i] += target.gravity * delta;
+		motion[i] = target.velocity[i] * delta;
+	}
+	sweep_and_slide(target);
+	for (size_t i = 0; i < num_characters; i++) {
+		target.object[i]->getWorldTransform().setOrigin(physics::to(target.location[i]));
+		target.world->updateSingleAabb(target.object[i]);
+	}
+}
+
+// Forward, left, back and right in the low four bits. Shared by the local player, the server and
+// prediction, so the same buttons always walk the same way.
+glm::vec2 cw::characters::movement_from_buttons(uint8_t buttons) {
+	glm::vec2 movement { 0, 0 };
+	if (buttons & (1 << 1)) movement.x -= 1;
+	if (buttons & (1 << 3)) movement.x += 1;
+	if (buttons & (1 << 0)) movement.y += 1;
+	if (buttons & (1 << 2)) movement.y -= 1;
+	return movement;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include "physics.h"
+#include "queries.h"
+
+// Kinematic capsule characters stored as parallel arrays and stepped together. Movement is driven by
+// batched ground probes and capsule sweeps rather than by the dynamics world, so the cost per step
+// only depends on the number of characters. Locations are capsule centers in engine space.
+
+namespace cw::characters {
+	const int collision_group = btBroadphaseProxy::CharacterFilter;
+	const int collision_mask = btBroadphaseProxy::AllFilter ^ btBroadphaseProxy::CharacterFilter;
+	struct set {
+		btCollisionWorld *world = 0;
+		glm::vec3 gravity { 0, 0, -15 };
+		std::vector<glm::vec3> location;
+		std::vector<glm::vec3> velocity;
+		std::vector<float> radius;
+		std::vector<float> height;
+		std::vector<uint8_t> grounded;
+		std::vector<glm::vec2> movement_input;
+		std::vector<float> yaw_input;
+		std::vector<btCapsuleShape *> shape;
+		std::vector<btCollisionObject *> object;
+		queries::ray_batch ground_probes;
+		queries::sweep_batch sweeps;
+		queries::results ground_results;
+		queries::results sweep_results;
+		std::vector<size_t> sweep_owners;
+		// Each character's motion still to be swept this step, kept between steps for its capacity.
+		std::vector<glm::vec3> motion;
+		size_t size() const { return location.size(); }
+	};
+	size_t create(set &target, const glm::vec3 &location, float radius = 0.65f, float height = 2.0f);
+	void destroy(set &target, size_t index);
+	void clear(set &target);
+	void step(set &target, float delta);
+	glm::vec2 movement_from_buttons(uint8_t buttons);
+}
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <imgui.h>
+#include <fmt/format.h>
 #include <assert.h>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -10,10 +11,18 @@
 #include "pov.h"
 #include "meshes.h"
 #include "materials.h"
+#include "textures.h"
 #include "sun.h"
 #include "net.h"
 #include "scene.h"
 #include "local_player.h"
+#include "characters.h"
+#include "rollback.h"
+#include "projectiles.h"
+#include "motion.h"
+#include "replay.h"
+#include "replication.h"
+#include "prediction.h"
 
 namespace cw::core {
 	void initialize();
@@ -25,19 +34,49 @@ namespace cw::core {
 	void on_shadow_map_render();
 	void on_imgui();
 	float black_screen = 1.0f;
+	characters::set characters;
+	const size_t rollback_ticks = 64;
+	rollback::history history;
+	uint64_t fixed_step_tick = 0;
+	const size_t max_projectiles = 2048;
+	projectiles::pool projectiles;
+	// What the server we're connected to last told us about the world.
+	replication::client replicated;
+	prediction::history predicted;
+	// Entity the prediction history belongs to, a new welcome starts it over.
+	uint32_t predicted_entity = 0;
+	// Fraction of the correction offset left after each fixed step.
+	const float correction_decay = 0.8f;
+	// meshes::layout as placed in this world. Each prop is drawn from its node, and cw::motion
+	// moves the nodes of loose ones.
+	struct placed_prop {
+		const meshes::placement *source = 0;
+		btCollisionObject *object = 0;
+		std::shared_ptr<node> transform;
+	};
+	std::vector<placed_prop> placed_props;
+	void predict(const double &delta);
+	void draw_props(GLuint program, const glm::mat4 &view_projection, bool request_textures);
 }
 
 namespace cw::local_player {
-	extern btRigidBody *rigid_body;
 	extern bool binary_input[4];
+	extern float tick_yaw;
 	extern glm::vec2 movement_input;
 	extern glm::vec3 location_interpolation_pair[2];
 	extern glm::vec3 interpolated_location;
+	extern glm::vec3 correction_offset;
 	void initialize();
 	void shutdown();
+	void sync_replay();
+}
+
+namespace cw::physics {
+	void step(const double &delta);
 }
 
 namespace cw::weapon {
+	void on_fixed_step(const double &delta);
 	void update(const double &delta);
 	void render_local_player_hud_model();
 }
@@ -57,44 +96,90 @@ namespace cw::scene {
 namespace cw::sys {
 	extern bool enable_mouse_grab;
 	extern float mouse_look_sensitivity;
+	void set_simulation_rate(uint32_t rate);
 }
 
 void cw::core::initialize() {
 	sys::enable_mouse_grab = false;
+	characters.world = physics::dynamics_world;
+	rollback::reserve(history, rollback_ticks);
+	projectiles::reserve(projectiles, max_projectiles);
+	fixed_step_tick = 0;
+	for (auto &placement : meshes::layout) {
+		auto transform = std::make_shared<node>();
+		transform->location = placement.location;
+		transform->orientation = placement.orientation;
+		transform->scale = placement.scale;
+		transform->needs_local_update = true;
+		motion::state *motion_state = placement.mass > 0 ? motion::bind(transform) : 0;
+		auto object = meshes::place(physics::dynamics_world, placement, motion_state);
+		if (!object) {
+			if (motion_state) motion::unbind(motion_state);
+			continue;
+		}
+		scene::nodes.push_back(transform);
+		placed_props.push_back({ &placement, object, transform });
+	}
 	local_player::initialize();
+	replication::reset(replicated);
+	net::default_host.on_receive = [](ENetPeer *peer, const uint8_t *data, size_t size) {
+		replication::receive(replicated, peer, data, size);
+	};
+	net::default_host.on_peer = [](ENetPeer *peer, bool connected) {
+		if (!connected) replication::reset(replicated);
+	};
 }
 
 void cw::core::shutdown() {
+	net::default_host.on_receive = nullptr;
+	net::default_host.on_peer = nullptr;
 	local_player::shutdown();
+	characters::clear(characters);
+	projectiles::release(projectiles);
+	for (auto &placed : placed_props) {
+		if (auto motion_state = meshes::remove(physics::dynamics_world, placed.object)) motion::unbind(static_cast<motion::state *>(motion_state));
+	}
+	placed_props.clear();
 }
 
 void cw::core::on_fixed_step(const double &delta) {
-	assert(physics::dynamics_world->stepSimulation(delta, 0, 0) == 1);
+	physics::step(delta);
+	motion::flush();
+	local_player::sync_replay();
+	uint8_t buttons = 0;
+	for (size_t i = 0; i < 4; i++) buttons |= local_player::binary_input[i] << i;
+	local_player::movement_input = characters::movement_from_buttons(buttons);
+	characters.movement_input[local_player::character] = local_player::movement_input;
+	characters.yaw_input[local_player::character] = local_player::tick_yaw;
+	if (net::default_host.current_state == net::state::client) predict(delta);
+	else predicted_entity = 0;
+	characters::step(characters, delta);
+	if (net::default_host.current_state == net::state::client && predicted_entity) {
+		const replication::input_command command { static_cast<uint32_t>(fixed_step_tick + 1), buttons, local_player::tick_yaw };
+		prediction::record(predicted, command, prediction::read(characters, local_player::character));
+		replication::input_command unacknowledged[replication::max_inputs_per_packet];
+		const size_t count = prediction::unacknowledged(predicted, replicated.acknowledged_input, unacknowledged, replication::max_inputs_per_packet);
+		if (!net::default_host.active_peers.empty()) replication::send_inputs(net::default_host.active_peers.front(), unacknowledged, count);
+	}
+	weapon::on_fixed_step(delta);
+	rollback::capture(history, ++fixed_step_tick, physics::dynamics_world, characters);
+	if (replay::hash_due()) replay::check_state(rollback::hash(history, fixed_step_tick));
 	local_player::location_interpolation_pair[0] = local_player::location_interpolation_pair[1];
-	local_player::location_interpolation_pair[1] = physics::from(local_player::rigid_body->getWorldTransform().getOrigin());
-	auto ray_from = local_player::rigid_body->getWorldTransform().getOrigin();
-	auto ray_to = local_player::rigid_body->getWorldTransform().getOrigin() - btVector3(0, 2.5f, 0);
-	btCollisionWorld::ClosestRayResultCallback ray_cb(ray_from, ray_to);
-	ray_cb.m_collisionFilterGroup = 2;
-	physics::dynamics_world->rayTest(ray_from, ray_to, ray_cb);
-	if (ray_cb.hasHit()) {
-		local_player::rigid_body->setLinearFactor(btVector3(1.0f, 1.0f, 1.0f));
-		local_player::movement_input = { 0, 0 };
-		if (local_player::binary_input[1]) local_player::movement_input.x -= 1;
-		if (local_player::binary_input[3]) local_player::movement_input.x += 1;
-		if (local_player::binary_input[0]) local_player::movement_input.y += 1;
-		if (local_player::binary_input[2]) local_player::movement_input.y -= 1;
-		glm::vec3 bipedal_movement(local_player::movement_input, 0);
-		if (local_player::movement_input.x || local_player::movement_input.y) {
-			local_player::movement_input = glm::normalize(local_player::movement_input) * 10.0f;
-			bipedal_movement = glm::vec4(local_player::movement_input, 0, 0) * glm::rotate(glm::radians(cw::pov::orientation.x), glm::vec3(0, 0, 1));
-			bipedal_movement.y *= -1.0f;
-		}
-		float diff = 2.5f - (ray_cb.m_rayFromWorld.y() - ray_cb.m_hitPointWorld.y());
-		diff *= 10.0f;
-		auto old_velocity = local_player::rigid_body->getLinearVelocity();
-		local_player::rigid_body->setLinearVelocity(btVector3(bipedal_movement.x, glm::mix(old_velocity.y(), diff, 0.99f), bipedal_movement.y));
-	} else local_player::rigid_body->setLinearFactor(btVector3(0.5f, 1.0f, 0.5f));
+	local_player::location_interpolation_pair[1] = characters.location[local_player::character] + local_player::correction_offset;
+	local_player::correction_offset *= correction_decay;
+}
+
+// Runs before the local character's step: starts over for a new entity, then folds in whatever
+// the server has confirmed since the last step.
+void cw::core::predict(const double &delta) {
+	if (replicated.entity != predicted_entity) {
+		prediction::reset(predicted);
+		predicted_entity = replicated.entity;
+		sys::set_simulation_rate(replicated.simulation_rate);
+	}
+	if (!predicted_entity) return;
+	glm::vec3 correction;
+	if (prediction::reconcile(predicted, replicated.acknowledged_input, replicated.authoritative, characters, local_player::character, static_cast<float>(delta), correction)) local_player::correction_offset += correction;
 }
 
 void cw::core::on_update(const double &delta, const double &interpolation) {
@@ -116,6 +201,7 @@ void cw::core::on_update(const double &delta, const double &interpolation) {
 	sun::shadow_projection_matrix = glm::ortho<float>(-60.0f, 60.0f, -60.0f, 60.0f, 0.0f, 120.0f);
 	sun::shadow_matrix = sun::shadow_projection_matrix * sun::shadow_view_matrix;
 	weapon::update(delta);
+	motion::interpolate(static_cast<float>(interpolation));
 	scene::update(interpolation);
 	if (black_screen > 0.0f) {
 		black_screen -= delta * 4.0;
@@ -128,50 +214,41 @@ void cw::core::on_relative_mouse_input(int x, int y) {
 	pov::orientation.y += y * sys::mouse_look_sensitivity;
 }
 
-void cw::core::on_deferred_render() {
-	voxels::render();
-	auto program = gpu::programs["mesh"];
-	// test
-	{
-		auto prop = meshes::props["future_chair_1"];
-		auto model = glm::identity<glm::mat4>();
-		model *= glm::translate(glm::vec3(64, 64, 20.5f));
-		model *= glm::scale(glm::vec3(0.025f));
-		auto total_transform = cw::pov::projection_matrix * cw::pov::view_matrix * model;
-		glUseProgram(program);
+// Shared by both passes, only the deferred one asks the texture pool for the mips it needs.
+void cw::core::draw_props(GLuint program, const glm::mat4 &view_projection, bool request_textures) {
+	glUseProgram(program);
+	for (auto &placed : placed_props) {
+		auto &prop = meshes::props[placed.source->prop_name];
+		auto &model = placed.transform->absolute_transform;
+		auto total_transform = view_projection * model;
 		glUniformMatrix4fv(glGetUniformLocation(program, "world_transform"), 1, GL_FALSE, glm::value_ptr(model));
 		glUniformMatrix4fv(glGetUniformLocation(program, "total_transform"), 1, GL_FALSE, glm::value_ptr(total_transform));
+		float prop_extent = 0;
+		if (request_textures) {
+			const auto &scale = placed.source->scale;
+			auto prop_center = glm::vec3(model * glm::vec4((prop.aabb[0] + prop.aabb[1]) * 0.5f, 1));
+			prop_extent = pov::screen_extent(prop_center, glm::length(prop.aabb[1] - prop.aabb[0]) * 0.5f * glm::max(scale.x, glm::max(scale.y, scale.z)), gpu::render_target_size.y);
+		}
+		glBindVertexArray(prop.array);
 		for (auto &part : prop.parts) {
-			glBindVertexArray(part.array);
-			glBindBuffer(GL_ARRAY_BUFFER, part.buffer);
-			float material_id = static_cast<size_t>(std::distance(materials::registry.begin(), materials::registry.find(part.material_name)));
-			glUniform2f(glGetUniformLocation(program, "material_identifier"), 0, material_id);
-			glDrawArrays(GL_TRIANGLES, 0, part.num_vertices);
+			const auto material = materials::identifier(part.material_name);
+			if (!material) continue;
+			if (request_textures) textures::request(static_cast<uint32_t>(material->x), prop_extent);
+			glUniform2f(glGetUniformLocation(program, "material_identifier"), material->x, material->y);
+			glDrawElementsBaseVertex(GL_TRIANGLES, part.num_indices, GL_UNSIGNED_INT, reinterpret_cast<void *>(sizeof(uint32_t) * part.first_index), part.base_vertex);
 		}
 	}
+}
+
+void cw::core::on_deferred_render() {
+	voxels::render();
+	draw_props(gpu::programs["mesh"], pov::projection_matrix * pov::view_matrix, true);
 	weapon::render_local_player_hud_model();
 }
 
 void cw::core::on_shadow_map_render() {
 	voxels::render_shadow_map();
-	//
-	auto program = gpu::programs["mesh-shadow-map"];
-	// test
-	auto prop = meshes::props["future_chair_1"];
-	auto model = glm::identity<glm::mat4>();
-	model *= glm::translate(glm::vec3(64, 64, 20.5f));
-	model *= glm::scale(glm::vec3(0.025f));
-	auto total_transform = sun::shadow_projection_matrix * sun::shadow_view_matrix * model;
-	glUseProgram(program);
-	glUniformMatrix4fv(glGetUniformLocation(program, "world_transform"), 1, GL_FALSE, glm::value_ptr(model));
-	glUniformMatrix4fv(glGetUniformLocation(program, "total_transform"), 1, GL_FALSE, glm::value_ptr(total_transform));
-	for (auto &part : prop.parts) {
-		glBindVertexArray(part.array);
-		glBindBuffer(GL_ARRAY_BUFFER, part.buffer);
-		float material_id = static_cast<size_t>(std::distance(materials::registry.begin(), materials::registry.find(part.material_name)));
-		glUniform2f(glGetUniformLocation(program, "material_identifier"), 0, material_id);
-		glDrawArrays(GL_TRIANGLES, 0, part.num_vertices);
-	}
+	draw_props(gpu::programs["mesh-shadow-map"], sun::shadow_projection_matrix * sun::shadow_view_matrix, false);
 }
 
 void cw::core::on_imgui() {
@@ -199,17 +276,26 @@ void cw::core::on_imgui() {
 	ImGui::Begin("Multiplayer");
 	ImGui::InputText("IP Address", ip_buffer, 15);
 	ImGui::InputInt("Port", &port_buffer);
-	if (ImGui::Button("Connect")) net::start_connection_attempt(ip_buffer, port_buffer);
+	if (ImGui::Button("Connect")) net::start_connection_attempt(net::default_host, ip_buffer, port_buffer);
 	ImGui::SameLine();
 	if (ImGui::Button("Host")) {
 		if (port_buffer < 0 || port_buffer > std::numeric_limits<uint16_t>::max()) std::cout << "Cannot host. Specified port is out of range." << std::endl;
-		else net::become_server(static_cast<uint16_t>(port_buffer));
+		else net::become_server(net::default_host, static_cast<uint16_t>(port_buffer));
 	}
 	ImGui::SameLine();
-	if (ImGui::Button("Quit")) net::shutdown();
-	if (net::current_state == net::state::idle) ImGui::Text("Status: Idle");
-	else if (net::current_state == net::state::connecting) ImGui::Text("Status: Connecting...");
-	else if (net::current_state == net::state::client) ImGui::Text("Status: Connected!");
-	else if (net::current_state == net::state::server) ImGui::Text("Status: Hosting!");
+	if (ImGui::Button("Quit")) {
+		net::shutdown(net::default_host);
+		replication::reset(replicated);
+	}
+	if (net::default_host.current_state == net::state::idle) ImGui::Text("Status: Idle");
+	else if (net::default_host.current_state == net::state::connecting) ImGui::Text("Status: Connecting...");
+	else if (net::default_host.current_state == net::state::client) {
+		ImGui::Text("Status: Connected!");
+		ImGui::Text(static_cast<std::string>(fmt::format("Entity: {}, Snapshot: {} (tick {}), Entities: {}", replicated.entity, replicated.latest.sequence, replicated.latest.tick, replicated.latest.entities.size())).c_str());
+		ImGui::Text(static_cast<std::string>(fmt::format("Received: {:.1f} KiB in {} snapshots ({} undecodable)", replicated.bytes_received / 1024.0, replicated.num_snapshots, replicated.num_undecodable)).c_str());
+		ImGui::Text(static_cast<std::string>(fmt::format("Unacknowledged Inputs: {}", predicted.newest > replicated.acknowledged_input ? predicted.newest - replicated.acknowledged_input : 0)).c_str());
+		ImGui::Text(static_cast<std::string>(fmt::format("Corrections: {}, last replayed {} ticks", predicted.num_corrections, predicted.last_replayed_ticks)).c_str());
+		ImGui::Text(static_cast<std::string>(fmt::format("Replay Cost: {:.3f} ms (mean {:.3f} ms, max {:.3f} ms)", predicted.last_replay_ms, predicted.mean_replay_ms, predicted.max_replay_ms)).c_str());
+	} else if (net::default_host.current_state == net::state::server) ImGui::Text("Status: Hosting!");
 	ImGui::End();
 }
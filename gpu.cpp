@@ -5,6 +5,8 @@
 #include "materials.h"
 #include "sun.h"
 #include "cfg.h"
+#include "pack.h"
+#include "jobs.h"
 
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
@@ -14,6 +16,7 @@
 #include <iostream>
 #include <filesystem>
 #include <optional>
+#include <string_view>
 #include <map>
 #include <string.h>
 #include <assert.h>
@@ -33,9 +36,10 @@ namespace cw::gpu {
 	void print_program_info_log(GLuint id);
 	GLuint make_program_from_shaders(const std::vector<GLuint> &shaders);
 	void print_shader_info_log(GLuint id);
-	void perform_shader_preprocessor(const std::filesystem::path &path, std::vector<char> &content);
+	std::optional<std::string> perform_shader_preprocessor(const std::filesystem::path &path, std::string_view content);
 	GLuint make_shader_from_file(const std::filesystem::path &path);
-	std::optional<std::map<std::string, GLuint>> make_programs_from_directory(const std::filesystem::path &path);
+	GLuint make_program_from_files(const std::string &directory, const std::string &name, const std::vector<std::string> &extensions);
+	jobs::task_handle make_programs_from_directory(const std::string &directory, const jobs::task_handle &after, jobs::counter &progress, bool &success);
 	void make_screen_quad();
 	void generate_render_targets();
 	void generate_shadow_render_targets();
@@ -45,20 +49,20 @@ namespace cw::gpu {
 }
 
 namespace cw::textures {
-
-	extern GLuint x256_array;
-	extern GLuint x512_array;
-	extern GLuint x1024_array;
-
+	extern GLuint pool_array;
+	extern GLuint pool_transform_buffer;
 	void load_all();
+	void shutdown();
+	void update();
 }
 
 namespace cw::sys::preload {
-	void update();
+	bool run_until(const jobs::task_handle &finished, const jobs::counter &progress);
 }
 
 namespace cw::meshes {
-	void load_all();
+	jobs::task_handle load_all(const jobs::task_handle &after, jobs::counter &progress);
+	void shutdown();
 }
 
 namespace cw::core {
@@ -109,10 +113,10 @@ void cw::gpu::print_shader_info_log(GLuint id) {
 	std::cout << log.data() << std::endl;
 }
 
-void cw::gpu::perform_shader_preprocessor(const std::filesystem::path &path, std::vector<char> &content) {
+std::optional<std::string> cw::gpu::perform_shader_preprocessor(const std::filesystem::path &path, std::string_view content) {
 	const char *material_resolver_code = "{{{ MATERIAL RESOLVER CODE}}}";
-	std::string copy_of(content.begin(), content.end());
-	if (auto position = copy_of.find(material_resolver_code); position != std::string::npos) {
+	if (auto position = content.find(material_resolver_code); position != std::string::npos) {
+		std::string copy_of(content);
 		std::cout << "Writing runtime-generated material resolver code to shader: \"" << path.string() << "\"" << std::endl;
 		std::string code;
 		code += "vec3 resolve_material_diffuse(float material_id) {";
@@ -124,14 +128,16 @@ void cw::gpu::perform_shader_preprocessor(const std::filesystem::path &path, std
 		}
 		code += "}";
 		copy_of.replace(position, strlen(material_resolver_code), code);
-		content = std::vector<char>(copy_of.begin(), copy_of.end());
+		return copy_of;
 	}
+	return std::nullopt;
 }
 
 GLuint cw::gpu::make_shader_from_file(const std::filesystem::path &path) {
-	auto content = cw::misc::read_file(path);
-	if (!content) return 0;
-	perform_shader_preprocessor(path, *content);
+	auto asset = pack::open(path.generic_string());
+	if (!asset) return 0;
+	// Shaders without generated code are handed to GL straight from the pack.
+	auto generated = perform_shader_preprocessor(path, std::string_view(asset->data, asset->size));
 	GLenum type;
 	if (path.extension().string() == ".vs") type = GL_VERTEX_SHADER;
 	else if (path.extension().string() == ".fs") type = GL_FRAGMENT_SHADER;
@@ -142,8 +148,8 @@ GLuint cw::gpu::make_shader_from_file(const std::filesystem::path &path) {
 	}
 	GLuint id = glCreateShader(type);
 	assert(id);
-	const GLchar *const pointer = content->data();
-	GLint content_length = content->size();
+	const GLchar *const pointer = generated ? generated->data() : asset->data;
+	GLint content_length = generated ? generated->size() : asset->size;
 	glShaderSource(id, 1, &pointer, &content_length);
 	glCompileShader(id);
 	GLint success;
@@ -156,46 +162,56 @@ GLuint cw::gpu::make_shader_from_file(const std::filesystem::path &path) {
 	return id;
 }
 
-std::optional<std::map<std::string, GLuint>> cw::gpu::make_programs_from_directory(const std::filesystem::path &path) {
-	auto map = cw::misc::map_file_names_and_extensions(path);
-	if (!map) return std::nullopt;
-	std::map<std::string, GLuint> programs;
-	std::vector<GLuint> all_shaders;
+GLuint cw::gpu::make_program_from_files(const std::string &directory, const std::string &name, const std::vector<std::string> &extensions) {
+	std::vector<GLuint> shaders;
 	bool success = true;
-	for (auto &pair : *map) {
-		sys::preload::update();
-		std::vector<GLuint> shaders;
-		for (auto &extension : pair.second) {
-			auto shader = make_shader_from_file(path.string() + pair.first + extension);
-			if (!shader) {
-				std::cout << "GL shader: " << pair.first << "[" << extension << "] -> ";
-				std::cout << "Failed to compile." << std::endl;
-				success = false;
-				break;
-			}
-			std::cout << "GL shader: " << pair.first << "[" << extension << "] -> ";
-			std::cout << "Compiled." << " (" << shader << ")" << std::endl;
-			all_shaders.push_back(shader);
-			shaders.push_back(shader);
-		}
-		if (!success) break;
-		auto program = make_program_from_shaders(shaders);
-		if (!program) {
-			std::cout << "GL program: " << pair.first << " -> ";
-			std::cout << "Failed to link." << std::endl;
+	for (auto &extension : extensions) {
+		auto shader = make_shader_from_file(directory + "/" + name + extension);
+		if (!shader) {
+			std::cout << "GL shader: " << name << "[" << extension << "] -> ";
+			std::cout << "Failed to compile." << std::endl;
 			success = false;
 			break;
 		}
-		std::cout << "GL program: " << pair.first << " -> ";
-		std::cout << "Linked." << " (" << program << ")" << std::endl;
-		programs[pair.first] = program;
+		std::cout << "GL shader: " << name << "[" << extension << "] -> ";
+		std::cout << "Compiled." << " (" << shader << ")" << std::endl;
+		shaders.push_back(shader);
 	}
-	for (auto &shader : all_shaders) glDeleteShader(shader);
-	if (!success) {
+	GLuint program = 0;
+	if (success) {
+		program = make_program_from_shaders(shaders);
+		std::cout << "GL program: " << name << " -> ";
+		if (program) std::cout << "Linked." << " (" << program << ")" << std::endl;
+		else std::cout << "Failed to link." << std::endl;
+	}
+	for (auto &shader : shaders) glDeleteShader(shader);
+	return program;
+}
+
+cw::jobs::task_handle cw::gpu::make_programs_from_directory(const std::string &directory, const jobs::task_handle &after, jobs::counter &progress, bool &success) {
+	// Cleans up after a failure on the main thread, once every program has had its turn.
+	auto finished = jobs::make_task([&success]() {
+		if (success) return;
 		for (auto &pair : programs) glDeleteProgram(pair.second);
-		return std::nullopt;
+		programs.clear();
+	}, true);
+	if (after) jobs::depend(finished, after);
+	auto map = pack::map_file_names_and_extensions(directory);
+	if (!map) success = false;
+	else for (auto &pair : *map) {
+		// One program per task keeps each main thread slice short.
+		auto compile = jobs::make_task([directory, name = pair.first, extensions = pair.second, &success]() {
+			if (!success) return;
+			auto program = make_program_from_files(directory, name, extensions);
+			if (program) programs[name] = program;
+			else success = false;
+		}, true, &progress);
+		if (after) jobs::depend(compile, after);
+		jobs::depend(finished, compile);
+		jobs::launch(compile);
 	}
-	return programs;
+	jobs::launch(finished);
+	return finished;
 }
 
 void cw::gpu::make_screen_quad() {
@@ -329,14 +345,18 @@ bool cw::gpu::initialize() {
 	gamma_power = system_cfg["gamma"];
 	if (system_cfg.find("sharpening") == system_cfg.end()) system_cfg["sharpening"] = sharpening_power;
 	sharpening_power = system_cfg["sharpening"];
-	textures::load_all();
-	meshes::load_all();
-	auto result = make_programs_from_directory(sys::bin_path().string() + "glsl\\");
-	if (!result) {
+	// Shaders are generated from the material registry, which is filled in as props finish loading.
+	jobs::counter progress;
+	bool programs_ready = true;
+	auto textures_loaded = jobs::make_task(textures::load_all, true, &progress);
+	auto props_loaded = meshes::load_all(textures_loaded, progress);
+	auto programs_loaded = make_programs_from_directory("glsl", props_loaded, progress, programs_ready);
+	jobs::launch(textures_loaded);
+	if (!sys::preload::run_until(programs_loaded, progress)) return false;
+	if (!programs_ready) {
 		std::cout << "Failed to create GPU programs." << std::endl;
 		return false;
 	}
-	programs = *result;
 	make_screen_quad();
 	return true;
 }
@@ -347,9 +367,12 @@ void cw::gpu::shutdown() {
 	system_cfg["exposure"] = exposure_power;
 	system_cfg["gamma"] = gamma_power;
 	system_cfg["sharpening"] = sharpening_power;
+	meshes::shutdown();
+	textures::shutdown();
 }
 
 void cw::gpu::render() {
+	textures::update();
 	glBindFramebuffer(GL_FRAMEBUFFER, shadow_frame_buffer);
 	glClearColor(1, 0, 0, 0);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -402,12 +425,9 @@ void cw::gpu::render() {
 	glActiveTexture(GL_TEXTURE2);
 	glBindTexture(GL_TEXTURE_2D, deferred_material_render_target);
 	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D_ARRAY, textures::x256_array);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textures::pool_array);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, textures::pool_transform_buffer);
 	glActiveTexture(GL_TEXTURE4);
-	glBindTexture(GL_TEXTURE_2D_ARRAY, textures::x512_array);
-	glActiveTexture(GL_TEXTURE5);
-	glBindTexture(GL_TEXTURE_2D_ARRAY, textures::x1024_array);
-	glActiveTexture(GL_TEXTURE6);
 	glBindTexture(GL_TEXTURE_2D, shadow_render_target);
 	glBindVertexArray(screen_quad_vertex_array);
 	glBindBuffer(GL_ARRAY_BUFFER, screen_quad_vertex_buffer);
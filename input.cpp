@@ -0,0 +1,40 @@
+#include "input.h"
+
+#include <atomic>
+
+namespace cw::input {
+	static_assert((capacity & (capacity - 1)) == 0, "Capacity must be a power of two.");
+	event events[capacity];
+	// Only the producer writes `head` and only the consumer writes `tail`.
+	std::atomic<size_t> head { 0 };
+	std::atomic<size_t> tail { 0 };
+}
+
+size_t cw::input::num_dropped = 0;
+
+// Fails when the consumer has fallen a whole queue behind, the event is dropped rather than blocking.
+bool cw::input::push(const event &new_event) {
+	const size_t current_head = head.load(std::memory_order_relaxed);
+	if (current_head - tail.load(std::memory_order_acquire) == capacity) {
+		num_dropped++;
+		return false;
+	}
+	events[current_head & (capacity - 1)] = new_event;
+	head.store(current_head + 1, std::memory_order_release);
+	return true;
+}
+
+// Takes the oldest event if it happened no later than `time`.
+bool cw::input::pop_until(uint64_t time, event &out) {
+	const size_t current_tail = tail.load(std::memory_order_relaxed);
+	if (current_tail == head.load(std::memory_order_acquire)) return false;
+	const auto &oldest = events[current_tail & (capacity - 1)];
+	if (oldest.time > time) return false;
+	out = oldest;
+	tail.store(current_tail + 1, std::memory_order_release);
+	return true;
+}
+
+size_t cw::input::size() {
+	return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Gameplay input as a stream of timestamped events. Events are pushed as soon as the OS hands them
+// over and each fixed step takes exactly the ones stamped inside its own time slice, so several steps
+// in one frame see the input in the order and at the time it happened. Single producer, single
+// consumer and lock-free, so the producer and consumer may live on different threads.
+
+namespace cw::input {
+	// The first four match the order of local_player::binary_input.
+	enum class action : int32_t {
+		move_forward,
+		move_left,
+		move_back,
+		move_right,
+		fire,
+		equip_personal_defense_gun,
+		equip_grenade_launcher,
+		none
+	};
+	enum class kind : uint8_t {
+		press,
+		release,
+		look
+	};
+	struct event {
+		// Steady clock nanoseconds when the event was collected.
+		uint64_t time;
+		kind type;
+		action code;
+		// Yaw and pitch change for `look` events, already scaled by the mouse sensitivity.
+		float x, y;
+	};
+	const size_t capacity = 4096;
+	extern size_t num_dropped;
+	bool push(const event &new_event);
+	bool pop_until(uint64_t time, event &out);
+	size_t size();
+}
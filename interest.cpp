@@ -0,0 +1,70 @@
+#include "interest.h"
+
+#include <cmath>
+#include <glm/geometric.hpp>
+
+namespace cw::interest {
+	const uint8_t no_tier = 0xff;
+	uint64_t cell_key(int32_t x, int32_t y);
+	// Scratch for the next tier memory, swapped in at the end of a selection.
+	thread_local memory next_tiers;
+}
+
+uint64_t cw::interest::cell_key(int32_t x, int32_t y) {
+	return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+}
+
+// Columns rather than cubes, the maps are far wider than they are tall. Cleared buckets keep their
+// capacity, so a warm grid only allocates for columns nobody stood in before.
+void cw::interest::build(grid &target, float cell_size, const std::vector<replication::entity> &entities) {
+	target.cell_size = cell_size;
+	for (auto &cell : target.cells) cell.second.clear();
+	for (size_t i = 0; i < entities.size(); i++) {
+		const auto x = static_cast<int32_t>(std::floor(entities[i].location.x / cell_size));
+		const auto y = static_cast<int32_t>(std::floor(entities[i].location.y / cell_size));
+		target.cells[cell_key(x, y)].push_back(i);
+	}
+}
+
+// Fills `relevant` with the indices of every entity this client should know about, and `refresh`
+// with whether each one's state is due this snapshot. Refreshes within a tier are staggered by id
+// so a crowd doesn't all land on the same snapshot. The client's own entity is always relevant and
+// always refreshed.
+void cw::interest::select(const settings &config, const grid &source, const std::vector<replication::entity> &entities, const glm::vec3 &viewpoint, uint32_t own_entity, uint64_t snapshot, memory &tiers, std::vector<size_t> &relevant, std::vector<uint8_t> &refresh) {
+	relevant.clear();
+	refresh.clear();
+	next_tiers.clear();
+	if (config.tiers.empty()) return;
+	const float reach = config.tiers.back().radius * (1 + config.hysteresis);
+	const auto min_x = static_cast<int32_t>(std::floor((viewpoint.x - reach) / source.cell_size));
+	const auto max_x = static_cast<int32_t>(std::floor((viewpoint.x + reach) / source.cell_size));
+	const auto min_y = static_cast<int32_t>(std::floor((viewpoint.y - reach) / source.cell_size));
+	const auto max_y = static_cast<int32_t>(std::floor((viewpoint.y + reach) / source.cell_size));
+	for (int32_t x = min_x; x <= max_x; x++) {
+		for (int32_t y = min_y; y <= max_y; y++) {
+			auto cell = source.cells.find(cell_key(x, y));
+			if (cell == source.cells.end()) continue;
+			for (auto index : cell->second) {
+				const auto &candidate = entities[index];
+				const float distance = glm::length(candidate.location - viewpoint);
+				uint8_t tier = no_tier;
+				for (size_t t = 0; t < config.tiers.size(); t++) {
+					if (distance < config.tiers[t].radius) {
+						tier = static_cast<uint8_t>(t);
+						break;
+					}
+				}
+				auto previous = tiers.find(candidate.id);
+				const uint8_t previous_tier = previous == tiers.end() ? no_tier : previous->second;
+				if (previous_tier != no_tier && tier > previous_tier && distance < config.tiers[previous_tier].radius * (1 + config.hysteresis)) tier = previous_tier;
+				if (candidate.id == own_entity) tier = 0;
+				if (tier == no_tier) continue;
+				next_tiers[candidate.id] = tier;
+				relevant.push_back(index);
+				const bool due = (snapshot + candidate.id) % config.tiers[tier].interval == 0;
+				refresh.push_back(due || previous_tier == no_tier || candidate.id == own_entity);
+			}
+		}
+	}
+	tiers.swap(next_tiers);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+#include <glm/vec3.hpp>
+
+#include "replication.h"
+
+// Decides, per client, which entities go into its snapshots and how often. Entities are bucketed
+// into a uniform grid of vertical columns once per snapshot, and each client only looks at the
+// columns around its own character. Distance puts an entity in a tier, closer tiers are refreshed
+// more often, and an entity only drops to a farther tier once it's clearly past the boundary so
+// anything sitting on one doesn't flicker between rates.
+
+namespace cw::interest {
+	struct tier {
+		float radius;
+		// Refreshed on every nth snapshot.
+		uint32_t interval;
+	};
+	struct settings {
+		// Nearest first. Anything past the last radius isn't sent at all.
+		std::vector<tier> tiers { { 24, 1 }, { 64, 2 }, { 128, 4 } };
+		// How far past a tier's radius, as a fraction of it, an entity has to go to leave the tier.
+		float hysteresis = 0.1f;
+		float cell_size = 32;
+	};
+	struct grid {
+		float cell_size = 32;
+		std::unordered_map<uint64_t, std::vector<size_t>> cells;
+	};
+	// The tier each entity had for one client last time, kept between snapshots for the hysteresis.
+	using memory = std::unordered_map<uint32_t, uint8_t>;
+	void build(grid &target, float cell_size, const std::vector<replication::entity> &entities);
+	void select(const settings &config, const grid &source, const std::vector<replication::entity> &entities, const glm::vec3 &viewpoint, uint32_t own_entity, uint64_t snapshot, memory &tiers, std::vector<size_t> &relevant, std::vector<uint8_t> &refresh);
+}
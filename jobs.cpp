@@ -0,0 +1,191 @@
+#include "jobs.h"
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <assert.h>
+
+struct cw::jobs::task {
+	std::function<void()> work;
+	bool main_thread = false;
+	counter *progress = 0;
+	// One extra reference is held until launch() so dependencies can be wired up first.
+	size_t unfinished = 1;
+	bool done = false;
+	std::vector<task_handle> dependents;
+};
+
+namespace cw::jobs {
+	std::vector<std::thread> workers;
+	std::mutex queue_mutex;
+	std::condition_variable queue_condition;
+	std::deque<std::function<void()>> queue;
+	bool quit_signal = false;
+	std::mutex graph_mutex;
+	std::deque<task_handle> main_thread_queue;
+	void worker_main();
+	void release(const task_handle &target);
+	void complete(const task_handle &target);
+}
+
+void cw::jobs::worker_main() {
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex);
+			queue_condition.wait(lock, [] { return quit_signal || !queue.empty(); });
+			if (queue.empty()) return;
+			job = std::move(queue.front());
+			queue.pop_front();
+		}
+		job();
+	}
+}
+
+void cw::jobs::initialize(size_t num_workers) {
+	shutdown();
+	if (!num_workers) num_workers = std::max<size_t>(std::thread::hardware_concurrency(), 2) - 1;
+	quit_signal = false;
+	for (size_t i = 0; i < num_workers; i++) workers.emplace_back(worker_main);
+	std::cout << "Job system is ready. (" << workers.size() << " workers)" << std::endl;
+}
+
+void cw::jobs::shutdown() {
+	if (workers.empty()) return;
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		quit_signal = true;
+	}
+	queue_condition.notify_all();
+	for (auto &worker : workers) worker.join();
+	workers.clear();
+	std::cout << "Job system has shut down." << std::endl;
+}
+
+size_t cw::jobs::num_workers() {
+	return workers.size();
+}
+
+void cw::jobs::submit(std::function<void()> job) {
+	if (workers.empty()) {
+		job();
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		queue.push_back(std::move(job));
+	}
+	queue_condition.notify_one();
+}
+
+cw::jobs::task_handle cw::jobs::make_task(std::function<void()> work, bool main_thread, counter *progress) {
+	auto new_task = std::make_shared<task>();
+	new_task->work = std::move(work);
+	new_task->main_thread = main_thread;
+	new_task->progress = progress;
+	if (progress) progress->total++;
+	return new_task;
+}
+
+void cw::jobs::depend(const task_handle &target, const task_handle &dependency) {
+	std::lock_guard<std::mutex> lock(graph_mutex);
+	if (dependency->done) return;
+	target->unfinished++;
+	dependency->dependents.push_back(target);
+}
+
+void cw::jobs::launch(const task_handle &target) {
+	release(target);
+}
+
+bool cw::jobs::is_done(const task_handle &target) {
+	std::lock_guard<std::mutex> lock(graph_mutex);
+	return target->done;
+}
+
+void cw::jobs::release(const task_handle &target) {
+	{
+		std::lock_guard<std::mutex> lock(graph_mutex);
+		assert(target->unfinished);
+		if (--target->unfinished) return;
+		if (target->main_thread) {
+			main_thread_queue.push_back(target);
+			return;
+		}
+	}
+	submit([target]() {
+		if (target->work) target->work();
+		complete(target);
+	});
+}
+
+void cw::jobs::complete(const task_handle &target) {
+	std::vector<task_handle> dependents;
+	{
+		std::lock_guard<std::mutex> lock(graph_mutex);
+		target->done = true;
+		dependents.swap(target->dependents);
+	}
+	if (target->progress) target->progress->completed++;
+	for (auto &dependent : dependents) release(dependent);
+}
+
+size_t cw::jobs::run_main_thread_tasks(std::chrono::microseconds budget) {
+	auto start = std::chrono::steady_clock::now();
+	size_t count = 0;
+	while (true) {
+		task_handle next;
+		{
+			std::lock_guard<std::mutex> lock(graph_mutex);
+			if (main_thread_queue.empty()) break;
+			next = std::move(main_thread_queue.front());
+			main_thread_queue.pop_front();
+		}
+		if (next->work) next->work();
+		complete(next);
+		count++;
+		if (std::chrono::steady_clock::now() - start >= budget) break;
+	}
+	return count;
+}
+
+void cw::jobs::parallel_for(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)> &body, size_t max_chunks) {
+	if (begin >= end) return;
+	if (!max_chunks) max_chunks = workers.size() + 1;
+	const size_t range = end - begin;
+	const size_t chunk_size = std::max<size_t>({ grain, 1, (range + max_chunks - 1) / max_chunks });
+	const size_t num_chunks = (range + chunk_size - 1) / chunk_size;
+	if (num_chunks == 1) {
+		body(begin, end);
+		return;
+	}
+	struct shared_state {
+		std::atomic<size_t> next_chunk { 0 };
+		std::atomic<size_t> remaining_chunks { 0 };
+		std::mutex mutex;
+		std::condition_variable condition;
+	};
+	auto state = std::make_shared<shared_state>();
+	state->remaining_chunks = num_chunks;
+	// Chunks are claimed rather than assigned, so the caller picks up whatever the workers haven't
+	// started yet. That keeps nested calls from a worker from deadlocking on a busy pool.
+	auto run = [state, &body, begin, end, chunk_size, num_chunks]() {
+		size_t chunk;
+		while ((chunk = state->next_chunk++) < num_chunks) {
+			const size_t chunk_begin = begin + chunk * chunk_size;
+			body(chunk_begin, std::min(end, chunk_begin + chunk_size));
+			if (--state->remaining_chunks == 0) {
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->condition.notify_all();
+			}
+		}
+	};
+	for (size_t i = 1; i < num_chunks && i <= workers.size(); i++) submit(run);
+	run();
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->condition.wait(lock, [&state] { return state->remaining_chunks == 0; });
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+
+namespace cw::jobs {
+	struct counter {
+		std::atomic<size_t> total { 0 };
+		std::atomic<size_t> completed { 0 };
+	};
+	struct task;
+	using task_handle = std::shared_ptr<task>;
+	void initialize(size_t num_workers = 0);
+	void shutdown();
+	size_t num_workers();
+	void submit(std::function<void()> job);
+	task_handle make_task(std::function<void()> work, bool main_thread = false, counter *progress = 0);
+	void depend(const task_handle &target, const task_handle &dependency);
+	void launch(const task_handle &target);
+	bool is_done(const task_handle &target);
+	size_t run_main_thread_tasks(std::chrono::microseconds budget);
+	void parallel_for(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)> &body, size_t max_chunks = 0);
+	template <typename F> auto async(F function) -> std::future<decltype(function())> {
+		auto task = std::make_shared<std::packaged_task<decltype(function())()>>(std::move(function));
+		auto result = task->get_future();
+		submit([task]() { (*task)(); });
+		return result;
+	}
+}
@@ -1,52 +1,98 @@
 #include "local_player.h"
 #include "physics.h"
 #include "scene.h"
+#include "input.h"
+#include "weapon.h"
+#include "replay.h"
+#include "pov.h"
 
 #include <glm/vec3.hpp>
+#include <cstring>
 
 namespace cw::local_player {
-	btMotionState *motion_state = 0;
-	btCollisionShape *collision_shape = 0;
-	btRigidBody *rigid_body = 0;
+	size_t character = 0;
+	bool spawned = false;
 	bool binary_input[4];
-	glm::vec3 movement_input;
+	bool fire_input = false;
+	// Yaw as of the end of the fixed step being simulated, the camera runs ahead of it between steps.
+	float tick_yaw = 0;
+	// Where shots leave from this step. Taken from the camera once per step, not read from it mid step,
+	// so a replay can put back exactly what was aimed at.
+	glm::vec3 aim_origin { 0, 0, 0 };
+	glm::vec3 aim_direction { 0, 1, 0 };
+	glm::vec2 movement_input;
 	glm::vec3 location_interpolation_pair[2];
 	glm::vec3 interpolated_location;
+	// What's left of the last prediction correction, drawn on top of the simulated location and
+	// shrunk every step so the view glides to the corrected place rather than jumping.
+	glm::vec3 correction_offset { 0, 0, 0 };
 	void initialize();
 	void shutdown();
+	void consume_input(uint64_t until);
+	void sync_replay();
+}
+
+namespace cw::core {
+	extern characters::set characters;
 }
 
 std::shared_ptr<cw::node> cw::local_player::camera_proxy = std::make_shared<cw::node>();
 
 void cw::local_player::initialize() {
 	shutdown();
-	btTransform transform;
-	transform.setIdentity();
-	transform.setOrigin(physics::to(glm::vec3(0, 0, 10)));
-	motion_state = new btDefaultMotionState(transform);
-	collision_shape = new btCapsuleShape(0.65f, 2.0f);
-	btVector3 local_inertia;
-	collision_shape->calculateLocalInertia(1, local_inertia);
-	rigid_body = new btRigidBody(1, motion_state, collision_shape, local_inertia);
-	rigid_body->setAngularFactor(0);
-	rigid_body->setActivationState(DISABLE_DEACTIVATION);
-	physics::dynamics_world->addRigidBody(rigid_body, 2, 1);
+	const glm::vec3 spawn_location(0, 0, 10);
+	character = characters::create(core::characters, spawn_location);
+	spawned = true;
+	location_interpolation_pair[0] = location_interpolation_pair[1] = spawn_location;
 	scene::nodes.push_back(camera_proxy);
 
 }
 
 void cw::local_player::shutdown() {
-	if (rigid_body) {
-		physics::dynamics_world->removeRigidBody(rigid_body);
-		delete rigid_body;
-		rigid_body = 0;
+	if (spawned) {
+		characters::destroy(core::characters, character);
+		spawned = false;
 	}
-	if (collision_shape) {
-		delete collision_shape;
-		collision_shape = 0;
+}
+
+// Applies every queued input event stamped no later than `until`, the end of the coming fixed step.
+void cw::local_player::consume_input(uint64_t until) {
+	input::event next;
+	while (input::pop_until(until, next)) {
+		if (next.type == input::kind::look) {
+			tick_yaw += next.x;
+			continue;
+		}
+		const bool pressed = next.type == input::kind::press;
+		if (next.code <= input::action::move_right) binary_input[static_cast<size_t>(next.code)] = pressed;
+		else if (next.code == input::action::fire) fire_input = pressed;
+		else if (next.code == input::action::equip_personal_defense_gun && pressed) weapon::local_player_equipped = weapon::id::personal_defense_gun;
+		else if (next.code == input::action::equip_grenade_launcher && pressed) weapon::local_player_equipped = weapon::id::grenade_launcher;
 	}
-	if (motion_state) {
-		delete motion_state;
-		motion_state = 0;
+}
+
+// Records what the coming step reads from outside the simulation, or during playback overwrites it
+// with what was recorded. The tick itself is read by sys::replay_tick before the step.
+void cw::local_player::sync_replay() {
+	replay::tick_input input;
+	if (replay::current_mode == replay::mode::playing) {
+		input = replay::played_input;
+		for (size_t i = 0; i < 4; i++) binary_input[i] = input.buttons & (1 << i);
+		fire_input = input.buttons & (1 << 4);
+		weapon::local_player_equipped = static_cast<weapon::id>(input.equipped);
+		tick_yaw = input.yaw;
+		aim_origin = { input.aim_origin[0], input.aim_origin[1], input.aim_origin[2] };
+		aim_direction = { input.aim_direction[0], input.aim_direction[1], input.aim_direction[2] };
+		return;
 	}
+	aim_origin = pov::eye;
+	aim_direction = pov::look;
+	if (replay::current_mode != replay::mode::recording) return;
+	for (size_t i = 0; i < 4; i++) input.buttons |= binary_input[i] << i;
+	input.buttons |= fire_input << 4;
+	input.equipped = static_cast<uint8_t>(weapon::local_player_equipped);
+	input.yaw = tick_yaw;
+	memcpy(input.aim_origin, &aim_origin.x, sizeof(input.aim_origin));
+	memcpy(input.aim_direction, &aim_direction.x, sizeof(input.aim_direction));
+	replay::record_tick(input);
 }
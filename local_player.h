@@ -1,9 +1,10 @@
 #pragma once
 
 #include "physics.h"
+#include "characters.h"
 #include "node.h"
 
 namespace cw::local_player {
 	extern std::shared_ptr<node> camera_proxy;
-	extern btRigidBody *rigid_body;
+	extern size_t character;
 }
@@ -0,0 +1,127 @@
+#include "match.h"
+#include "meshes.h"
+
+#include <iostream>
+#include <glm/gtc/quaternion.hpp>
+
+namespace cw::match {
+	const glm::vec3 spawn_location(0, 0, 10);
+}
+
+void cw::match::create(instance &target, const std::string &name, int physics_threads, size_t rollback_ticks, size_t max_projectiles) {
+	target.name = name;
+	target.tick = 0;
+	physics::create_world(target.physics, physics_threads);
+	target.characters.world = target.physics.dynamics_world;
+	for (auto &placement : meshes::layout) {
+		if (auto object = meshes::place(target.physics.dynamics_world, placement)) target.placed_props.push_back(object);
+	}
+	projectiles::reserve(target.projectiles, max_projectiles);
+	rollback::reserve(target.history, rollback_ticks);
+	// Every peer that connects gets a character, and loses it again when it leaves.
+	target.host.on_peer = [&target](ENetPeer *peer, bool connected) {
+		if (connected) join(target, peer);
+		else leave(target, peer);
+	};
+	target.host.on_receive = [&target](ENetPeer *peer, const uint8_t *data, size_t size) {
+		replication::receive(target.replication, peer, data, size);
+	};
+	std::cout << "Created match \"" << name << "\"." << std::endl;
+}
+
+void cw::match::destroy(instance &target) {
+	net::shutdown(target.host);
+	target.host.on_peer = nullptr;
+	target.host.on_receive = nullptr;
+	target.replication.peers.clear();
+	characters::clear(target.characters);
+	target.character_index.clear();
+	target.characters.world = 0;
+	projectiles::release(target.projectiles);
+	for (auto object : target.placed_props) meshes::remove(target.physics.dynamics_world, object);
+	target.placed_props.clear();
+	physics::destroy_world(target.physics);
+	std::cout << "Destroyed match \"" << target.name << "\" after " << target.tick << " ticks." << std::endl;
+}
+
+void cw::match::step(instance &target, const double &delta) {
+	physics::step(target.physics, delta);
+	apply_inputs(target);
+	characters::step(target.characters, delta);
+	projectiles::step(target.projectiles, target.physics.dynamics_world, delta);
+	rollback::capture(target.history, ++target.tick, target.physics.dynamics_world, target.characters);
+	for (auto &peer : target.replication.peers) {
+		const size_t character = find_character(target, peer.entity);
+		if (character < target.characters.size()) peer.authoritative = { target.characters.location[character], target.characters.velocity[character], target.characters.grounded[character] != 0 };
+	}
+}
+
+// Each peer's character moves by one of its commands per step, in the same order as the client's
+// own fixed step so its prediction lands in the same place.
+void cw::match::apply_inputs(instance &target) {
+	for (auto &peer : target.replication.peers) {
+		replication::input_command command;
+		if (!replication::next_input(peer, command)) continue;
+		const size_t character = find_character(target, peer.entity);
+		if (character >= target.characters.size()) continue;
+		target.characters.movement_input[character] = characters::movement_from_buttons(command.buttons);
+		target.characters.yaw_input[character] = command.yaw;
+	}
+}
+
+void cw::match::join(instance &target, ENetPeer *peer) {
+	const size_t character = characters::create(target.characters, spawn_location);
+	const uint32_t entity = target.next_entity++;
+	target.characters.object[character]->setUserIndex(static_cast<int>(entity));
+	target.character_index[entity] = character;
+	replication::add_peer(target.replication, peer, entity);
+}
+
+void cw::match::leave(instance &target, ENetPeer *peer) {
+	for (auto &state : target.replication.peers) {
+		if (state.peer != peer) continue;
+		if (const size_t character = find_character(target, state.entity); character < target.characters.size()) {
+			characters::destroy(target.characters, character);
+			target.character_index.erase(state.entity);
+			// The last character took the freed slot.
+			if (character < target.characters.size()) target.character_index[static_cast<uint32_t>(target.characters.object[character]->getUserIndex())] = character;
+		}
+		break;
+	}
+	replication::remove_peer(target.replication, peer);
+}
+
+// Characters are swap-removed, so their index isn't stable and they're looked up by entity instead.
+size_t cw::match::find_character(const instance &target, uint32_t entity) {
+	auto found = target.character_index.find(entity);
+	return found == target.character_index.end() ? target.characters.size() : found->second;
+}
+
+// Characters and every dynamic rigid body, each picked up by an id the first time it's seen.
+void cw::match::replicate(instance &target) {
+	if (target.replication.peers.empty()) return;
+	target.entities.clear();
+	auto &characters = target.characters;
+	for (size_t i = 0; i < characters.size(); i++) {
+		const auto orientation = glm::angleAxis(glm::radians(-characters.yaw_input[i]), glm::vec3(0, 0, 1));
+		target.entities.push_back({ static_cast<uint32_t>(characters.object[i]->getUserIndex()), characters.location[i], orientation });
+	}
+	auto &objects = target.physics.dynamics_world->getCollisionObjectArray();
+	for (int i = 0; i < objects.size(); i++) {
+		auto body = btRigidBody::upcast(objects[i]);
+		if (!body || body->isStaticOrKinematicObject()) continue;
+		if (body->getUserIndex() <= 0) body->setUserIndex(static_cast<int>(target.next_entity++));
+		auto &transform = body->getWorldTransform();
+		target.entities.push_back({ static_cast<uint32_t>(body->getUserIndex()), physics::from(transform.getOrigin()), physics::from(transform.getRotation()) });
+	}
+	// The server has no camera, so each peer sees from its own character. Peers without one yet get everything.
+	interest::build(target.interest_grid, target.interest.cell_size, target.entities);
+	for (auto &peer : target.replication.peers) {
+		const size_t character = find_character(target, peer.entity);
+		peer.filtered = character < characters.size();
+		if (!peer.filtered) continue;
+		interest::select(target.interest, target.interest_grid, target.entities, characters.location[character], peer.entity, target.num_snapshots, peer.tiers, peer.relevant, peer.refresh);
+	}
+	replication::send_snapshots(target.replication, static_cast<uint32_t>(target.tick), target.entities);
+	target.num_snapshots++;
+}
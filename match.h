@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "physics.h"
+#include "characters.h"
+#include "projectiles.h"
+#include "rollback.h"
+#include "net.h"
+#include "replication.h"
+#include "interest.h"
+
+// Everything one running match owns. Matches never touch each other's state, so a server can step
+// several of them at once on the job system. Loaded props (meshes::props) are shared read-only by
+// all of them, each match only wraps the shared BVHs in its own collision objects.
+
+namespace cw::match {
+	struct instance {
+		std::string name;
+		physics::world physics;
+		characters::set characters;
+		projectiles::pool projectiles;
+		rollback::history history;
+		net::host host;
+		replication::server replication;
+		// Replicated ids, stored in each collision object's user index. 0 is never handed out.
+		uint32_t next_entity = 1;
+		// Where each character sits in `characters`, kept up to date as they're swap-removed.
+		std::unordered_map<uint32_t, size_t> character_index;
+		std::vector<replication::entity> entities;
+		interest::settings interest;
+		interest::grid interest_grid;
+		uint64_t num_snapshots = 0;
+		// Collision for meshes::layout.
+		std::vector<btCollisionObject *> placed_props;
+		uint64_t tick = 0;
+	};
+	void create(instance &target, const std::string &name, int physics_threads, size_t rollback_ticks, size_t max_projectiles);
+	void destroy(instance &target);
+	void step(instance &target, const double &delta);
+	void apply_inputs(instance &target);
+	void join(instance &target, ENetPeer *peer);
+	void leave(instance &target, ENetPeer *peer);
+	size_t find_character(const instance &target, uint32_t entity);
+	void replicate(instance &target);
+}
@@ -1,3 +1,14 @@
 #include "materials.h"
 
+#include <iterator>
+
 std::map<std::string, cw::materials::properties> cw::materials::registry;
+
+// What mesh shaders take as `material_identifier`: the pooled texture handle, 0 for none, and the
+// material's index in the registry for its flat diffuse color. Nothing for a name that was never
+// registered, callers skip those parts.
+std::optional<glm::vec2> cw::materials::identifier(const std::string &name) {
+	auto material = registry.find(name);
+	if (material == registry.end()) return std::nullopt;
+	return glm::vec2(static_cast<float>(material->second.texture), static_cast<float>(std::distance(registry.begin(), material)));
+}
@@ -2,12 +2,16 @@
 
 #include <cstdint>
 #include <map>
+#include <optional>
 #include <string>
+#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 
 namespace cw::materials {
 	struct properties {
 		glm::vec3 diffuse;
+		uint32_t texture = 0;
 	};
 	extern std::map<std::string, properties> registry;
+	std::optional<glm::vec2> identifier(const std::string &name);
 }
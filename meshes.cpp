@@ -1,8 +1,13 @@
 #include "misc.h"
 #include "sys.h"
-#include "gpu.h"
 #include "meshes.h"
+#include "jobs.h"
+#if !CW_HEADLESS
+#include "gpu.h"
 #include "materials.h"
+#include "textures.h"
+#endif
+#include "pack.h"
 
 #include <fmt/format.h>
 #include <assimp/Importer.hpp>
@@ -10,9 +15,15 @@
 #include <assimp/postprocess.h>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <glm/common.hpp>
 #include <iostream>
 #include <vector>
+#include <optional>
 #include <filesystem>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <limits>
 #include <assert.h>
 
 namespace cw::meshes {
@@ -20,91 +31,398 @@ namespace cw::meshes {
 		glm::vec3 position, normal;
 		glm::vec2 uv;
 	};
-	void load_all();
-	void load_props();
+	// Cooked props are laid out as a header, the part table, the vertex and index blobs, then
+	// Bullet-space positions and one in-place serialized BVH per part.
+	const uint32_t cooked_magic = 0x534d5743;
+	const uint32_t cooked_version = 2;
+	struct cooked_header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t source_hash;
+		uint32_t num_parts;
+		uint32_t num_vertices;
+		uint32_t num_indices;
+		uint32_t vertices_offset;
+		uint32_t indices_offset;
+		uint32_t physics_offset;
+		float aabb[6];
+	};
+	struct cooked_part {
+		uint32_t first_index;
+		uint32_t num_indices;
+		int32_t base_vertex;
+		uint32_t num_vertices;
+		float diffuse[3];
+		float aabb[6];
+		uint32_t bvh_offset;
+		uint32_t bvh_size;
+		char texture_name[44];
+	};
+	static_assert(sizeof(cooked_header) == 64);
+	static_assert(sizeof(cooked_part) == 104);
+	static_assert(sizeof(vertex) == 32);
+	jobs::task_handle load_all(const jobs::task_handle &after, jobs::counter &progress);
+	jobs::task_handle load_props(const jobs::task_handle &after, jobs::counter &progress);
+	struct pending_prop {
+		std::string name;
+		std::string source_name;
+		std::string cache_path;
+		uint64_t source_hash = 0;
+		bool ready = false;
+		cooked_header header;
+		const cooked_part *parts = 0;
+		const vertex *vertices = 0;
+		const uint32_t *indices = 0;
+		prop result;
+	};
+	std::optional<std::vector<char>> cook(const char *data, size_t size, uint64_t source_hash);
+	void prepare_prop(pending_prop &target);
+	bool prepare_cooked(pending_prop &target, std::shared_ptr<const void> storage, char *data, size_t size);
+	void finalize_prop(pending_prop &target);
+	btTriangleIndexVertexArray *make_triangle_index_vertex_array(const cooked_part &part, const float *positions, const uint32_t *indices);
+	size_t align_cooked_offset(size_t offset);
+	void shutdown();
 }
 
-namespace cw::sys::preload {
-	void update();
+std::map<std::string, cw::meshes::prop> cw::meshes::props;
+
+const std::vector<cw::meshes::placement> cw::meshes::layout {
+	{ "future_chair_1", { 64, 64, 20.5f }, glm::quat(1, 0, 0, 0), glm::vec3(0.025f) },
+	{ "weapon_launcher", { 64, 64, 24 }, glm::quat(1, 0, 0, 0), glm::vec3(0.4f), 2 }
+};
+
+cw::jobs::task_handle cw::meshes::load_all(const jobs::task_handle &after, jobs::counter &progress) {
+	return load_props(after, progress);
 }
 
-std::map<std::string, cw::meshes::prop> cw::meshes::props;
+size_t cw::meshes::align_cooked_offset(size_t offset) {
+	return (offset + 15) & ~static_cast<size_t>(15);
+}
+
+btTriangleIndexVertexArray *cw::meshes::make_triangle_index_vertex_array(const cooked_part &part, const float *positions, const uint32_t *indices) {
+	btIndexedMesh indexed_mesh;
+	indexed_mesh.m_numTriangles = part.num_indices / 3;
+	indexed_mesh.m_triangleIndexBase = reinterpret_cast<const unsigned char *>(indices + part.first_index);
+	indexed_mesh.m_triangleIndexStride = sizeof(uint32_t) * 3;
+	indexed_mesh.m_numVertices = part.num_vertices;
+	indexed_mesh.m_vertexBase = reinterpret_cast<const unsigned char *>(positions + part.base_vertex * 3);
+	indexed_mesh.m_vertexStride = sizeof(float) * 3;
+	indexed_mesh.m_indexType = PHY_INTEGER;
+	indexed_mesh.m_vertexType = PHY_FLOAT;
+	auto result = new btTriangleIndexVertexArray();
+	result->addIndexedMesh(indexed_mesh, PHY_INTEGER);
+	return result;
+}
+
+btCollisionShape *cw::meshes::make_collision_shape(const prop &source, const glm::vec3 &scale) {
+	const btVector3 physics_scale(scale.x, scale.z, scale.y);
+	if (source.parts.size() == 1) return new btScaledBvhTriangleMeshShape(source.parts[0].triangle_mesh_shape, physics_scale);
+	auto compound = new btCompoundShape(false, static_cast<int>(source.parts.size()));
+	btTransform identity;
+	identity.setIdentity();
+	for (auto &part : source.parts) compound->addChildShape(identity, new btScaledBvhTriangleMeshShape(part.triangle_mesh_shape, physics_scale));
+	return compound;
+}
 
-void cw::meshes::load_all() {
-	load_props();
+// Static props only share the prop's BVHs, the scaled wrappers belong to the object. Bullet can't
+// move a triangle mesh, so a loose prop is a box around its bounds instead. `motion_state` is handed
+// to loose props and stays the caller's, remove() gives it back. Props that failed to load are left out.
+btCollisionObject *cw::meshes::place(btDynamicsWorld *world, const placement &source, btMotionState *motion_state) {
+	auto found = props.find(source.prop_name);
+	if (found == props.end() || found->second.parts.empty()) {
+		std::cout << "Cannot place missing prop \"" << source.prop_name << "\"." << std::endl;
+		return 0;
+	}
+	const btTransform transform(physics::to(source.orientation), physics::to(source.location));
+	if (source.mass <= 0) {
+		auto object = new btCollisionObject;
+		object->setCollisionShape(make_collision_shape(found->second, source.scale));
+		object->setWorldTransform(transform);
+		world->addCollisionObject(object, btBroadphaseProxy::StaticFilter, btBroadphaseProxy::AllFilter ^ btBroadphaseProxy::StaticFilter);
+		return object;
+	}
+	const auto &aabb = found->second.aabb;
+	const auto half_extents = glm::abs(aabb[1] - aabb[0]) * source.scale * 0.5f;
+	auto shape = new btCompoundShape(false, 1);
+	btTransform offset;
+	offset.setIdentity();
+	offset.setOrigin(physics::to((aabb[0] + aabb[1]) * 0.5f * source.scale));
+	shape->addChildShape(offset, new btBoxShape({ half_extents.x, half_extents.z, half_extents.y }));
+	btVector3 local_inertia(0, 0, 0);
+	shape->calculateLocalInertia(source.mass, local_inertia);
+	btRigidBody::btRigidBodyConstructionInfo info(source.mass, motion_state, shape, local_inertia);
+	info.m_startWorldTransform = transform;
+	auto body = new btRigidBody(info);
+	world->addRigidBody(body);
+	return body;
 }
 
-void cw::meshes::load_props() {
-	for (auto &section : std::filesystem::directory_iterator(sys::bin_path().string() + "prop")) {
-		for (auto &file : std::filesystem::directory_iterator(section)) {
-			sys::preload::update();
-			auto file_contents = misc::read_file(file.path());
-			if (!file_contents) continue;
-			auto new_prop_name = section.path().stem().string() + "_" + file.path().stem().string();
-			Assimp::Importer importer;
-			auto scene = importer.ReadFileFromMemory(
-					file_contents->data(), file_contents->size(),
-					aiProcess_FlipUVs | aiProcess_OptimizeGraph | aiProcess_OptimizeMeshes | aiProcess_GenBoundingBoxes | aiProcess_JoinIdenticalVertices | aiProcess_Triangulate
-				);
-			if (!scene) {
-				std::cout << "Error while processing prop: " << file.path().string() << std::endl;
-				continue;
-			}
-			assert(scene->mNumMeshes > 0);
-			prop new_prop;
-			new_prop.aabb[0] = { scene->mMeshes[0]->mAABB.mMin.x, scene->mMeshes[0]->mAABB.mMin.x, scene->mMeshes[0]->mAABB.mMin.x };
-			new_prop.aabb[1] = { scene->mMeshes[0]->mAABB.mMax.x, scene->mMeshes[0]->mAABB.mMax.x, scene->mMeshes[0]->mAABB.mMax.x };
-			std::vector<vertex> vertices;
-			for (unsigned int mesh_index = 0; mesh_index < scene->mNumMeshes; mesh_index++) {
-				auto material = scene->mMaterials[scene->mMeshes[mesh_index]->mMaterialIndex];
-				aiColor3D diffuse;
-				assert(material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuse) == AI_SUCCESS);
-				auto registered_material_name = fmt::format("{}_mesh_{}", new_prop_name, mesh_index);
-				std::cout << "Registered material \"" << registered_material_name << "\"." << std::endl;
-				materials::registry[registered_material_name] = {
-					{ diffuse.r, diffuse.g, diffuse.b }
-				};
-				for (unsigned int face_index = 0; face_index < scene->mMeshes[mesh_index]->mNumFaces; face_index++) {
-					for (unsigned int i = 0; i < scene->mMeshes[mesh_index]->mFaces[face_index].mNumIndices; i++) {
-						const auto position = scene->mMeshes[mesh_index]->mVertices[scene->mMeshes[mesh_index]->mFaces[face_index].mIndices[i]];
-						const auto normal = scene->mMeshes[mesh_index]->mNormals[scene->mMeshes[mesh_index]->mFaces[face_index].mIndices[i]];
-						const auto uv = scene->mMeshes[mesh_index]->mTextureCoords[0][scene->mMeshes[mesh_index]->mFaces[face_index].mIndices[i]];
-						vertices.push_back({
-							{ position.x, position.y, position.z },
-							{ normal.x, normal.y, normal.z },
-							{ uv.x, uv.y }
-						});
-					}
-				}
-				mesh new_mesh;
-				auto physics_triangle_mesh = new btTriangleMesh();
-				for (size_t phyvi = 0; phyvi < vertices.size(); phyvi += 3) {
-					physics_triangle_mesh->addTriangle(
-						physics::to(vertices[phyvi].position),
-						physics::to(vertices[phyvi + 1].position),
-						physics::to(vertices[phyvi + 2].position)
-					);
-				}
-				new_mesh.triangle_mesh_shape = new btBvhTriangleMeshShape(physics_triangle_mesh, true);
-				new_mesh.material_name = registered_material_name;
-				glGenVertexArrays(1, &new_mesh.array);
-				assert(&new_mesh.array);
-				glGenBuffers(1, &new_mesh.buffer);
-				assert(new_mesh.buffer);
-				glBindVertexArray(new_mesh.array);
-				glBindBuffer(GL_ARRAY_BUFFER, new_mesh.buffer);
-				glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), 0);
-				glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), reinterpret_cast<void *>(sizeof(float) * 3));
-				glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), reinterpret_cast<void *>(sizeof(float) * 6));
-				glEnableVertexAttribArray(0);
-				glEnableVertexAttribArray(1);
-				glEnableVertexAttribArray(2);
-				glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertex), vertices.data(), GL_STATIC_DRAW);
-				new_mesh.num_vertices = vertices.size();
-				new_prop.parts.push_back(new_mesh);
-			}
-			props[new_prop_name] = new_prop;
-			std::cout << "Loaded prop \"" << new_prop_name << "\". " << new_prop.parts.size() << " parts." << std::endl;
+btMotionState *cw::meshes::remove(btCollisionWorld *world, btCollisionObject *object) {
+	world->removeCollisionObject(object);
+	btMotionState *motion_state = 0;
+	if (auto body = btRigidBody::upcast(object)) motion_state = body->getMotionState();
+	auto shape = object->getCollisionShape();
+	if (shape->isCompound()) {
+		auto compound = static_cast<btCompoundShape *>(shape);
+		for (int i = 0; i < compound->getNumChildShapes(); i++) delete compound->getChildShape(i);
+	}
+	delete shape;
+	delete object;
+	return motion_state;
+}
+
+// Every world must have removed its placed props by now, they still point at these shapes.
+void cw::meshes::shutdown() {
+	for (auto &pair : props) {
+		for (auto &part : pair.second.parts) {
+			delete part.triangle_mesh_shape;
+			delete part.triangle_index_vertex_array;
 		}
+#if !CW_HEADLESS
+		if (pair.second.element_buffer) glDeleteBuffers(1, &pair.second.element_buffer);
+		if (pair.second.buffer) glDeleteBuffers(1, &pair.second.buffer);
+		if (pair.second.array) glDeleteVertexArrays(1, &pair.second.array);
+#endif
+	}
+	props.clear();
+}
+
+std::optional<std::vector<char>> cw::meshes::cook(const char *data, size_t size, uint64_t source_hash) {
+	Assimp::Importer importer;
+	auto scene = importer.ReadFileFromMemory(
+			data, size,
+			aiProcess_FlipUVs | aiProcess_OptimizeGraph | aiProcess_OptimizeMeshes | aiProcess_GenBoundingBoxes | aiProcess_JoinIdenticalVertices | aiProcess_Triangulate
+		);
+	if (!scene || !scene->mNumMeshes) return std::nullopt;
+	std::vector<cooked_part> parts;
+	std::vector<vertex> vertices;
+	std::vector<uint32_t> indices;
+	glm::vec3 prop_aabb[2] = { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest()) };
+	for (unsigned int mesh_index = 0; mesh_index < scene->mNumMeshes; mesh_index++) {
+		auto source_mesh = scene->mMeshes[mesh_index];
+		auto material = scene->mMaterials[source_mesh->mMaterialIndex];
+		cooked_part part;
+		memset(&part, 0, sizeof(part));
+		part.first_index = static_cast<uint32_t>(indices.size());
+		part.base_vertex = static_cast<int32_t>(vertices.size());
+		part.num_vertices = source_mesh->mNumVertices;
+		aiColor3D diffuse(1, 1, 1);
+		material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuse);
+		part.diffuse[0] = diffuse.r;
+		part.diffuse[1] = diffuse.g;
+		part.diffuse[2] = diffuse.b;
+		aiString diffuse_texture;
+		if (material->GetTexture(aiTextureType_DIFFUSE, 0, &diffuse_texture) == AI_SUCCESS) {
+			auto texture_name = std::filesystem::path(diffuse_texture.C_Str()).stem().string();
+			strncpy(part.texture_name, texture_name.c_str(), sizeof(part.texture_name) - 1);
+		}
+		glm::vec3 part_aabb[2] = { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest()) };
+		for (unsigned int i = 0; i < source_mesh->mNumVertices; i++) {
+			const auto position = source_mesh->mVertices[i];
+			const auto normal = source_mesh->mNormals ? source_mesh->mNormals[i] : aiVector3D(0, 0, 1);
+			const auto uv = source_mesh->mTextureCoords[0] ? source_mesh->mTextureCoords[0][i] : aiVector3D(0, 0, 0);
+			vertices.push_back({
+				{ position.x, position.y, position.z },
+				{ normal.x, normal.y, normal.z },
+				{ uv.x, uv.y }
+			});
+			part_aabb[0] = glm::min(part_aabb[0], vertices.back().position);
+			part_aabb[1] = glm::max(part_aabb[1], vertices.back().position);
+		}
+		for (unsigned int face_index = 0; face_index < source_mesh->mNumFaces; face_index++) {
+			const auto &face = source_mesh->mFaces[face_index];
+			if (face.mNumIndices != 3) continue;
+			for (unsigned int i = 0; i < 3; i++) indices.push_back(face.mIndices[i]);
+		}
+		part.num_indices = static_cast<uint32_t>(indices.size()) - part.first_index;
+		memcpy(part.aabb, &part_aabb[0].x, sizeof(float) * 3);
+		memcpy(part.aabb + 3, &part_aabb[1].x, sizeof(float) * 3);
+		prop_aabb[0] = glm::min(prop_aabb[0], part_aabb[0]);
+		prop_aabb[1] = glm::max(prop_aabb[1], part_aabb[1]);
+		parts.push_back(part);
+	}
+	std::vector<float> physics_positions;
+	physics_positions.reserve(vertices.size() * 3);
+	for (auto &v : vertices) {
+		const auto position = physics::to(v.position);
+		physics_positions.push_back(position.x());
+		physics_positions.push_back(position.y());
+		physics_positions.push_back(position.z());
+	}
+	std::vector<std::vector<char>> bvh_blobs;
+	for (auto &part : parts) {
+		std::unique_ptr<btTriangleIndexVertexArray> mesh_interface(make_triangle_index_vertex_array(part, physics_positions.data(), indices.data()));
+		btBvhTriangleMeshShape shape(mesh_interface.get(), true, true);
+		auto bvh = shape.getOptimizedBvh();
+		std::vector<char> blob(bvh->calculateSerializeBufferSize());
+		// Bullet wants a 16 byte aligned buffer to serialize into.
+		void *scratch = btAlignedAlloc(blob.size(), 16);
+		bvh->serializeInPlace(scratch, static_cast<unsigned>(blob.size()), false);
+		memcpy(blob.data(), scratch, blob.size());
+		btAlignedFree(scratch);
+		bvh_blobs.push_back(std::move(blob));
+	}
+	cooked_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = cooked_magic;
+	header.version = cooked_version;
+	header.source_hash = source_hash;
+	header.num_parts = static_cast<uint32_t>(parts.size());
+	header.num_vertices = static_cast<uint32_t>(vertices.size());
+	header.num_indices = static_cast<uint32_t>(indices.size());
+	header.vertices_offset = static_cast<uint32_t>(sizeof(cooked_header) + parts.size() * sizeof(cooked_part));
+	header.indices_offset = static_cast<uint32_t>(header.vertices_offset + vertices.size() * sizeof(vertex));
+	header.physics_offset = static_cast<uint32_t>(align_cooked_offset(header.indices_offset + indices.size() * sizeof(uint32_t)));
+	memcpy(header.aabb, &prop_aabb[0].x, sizeof(float) * 3);
+	memcpy(header.aabb + 3, &prop_aabb[1].x, sizeof(float) * 3);
+	size_t cooked_size = header.physics_offset + physics_positions.size() * sizeof(float);
+	for (size_t i = 0; i < parts.size(); i++) {
+		cooked_size = align_cooked_offset(cooked_size);
+		parts[i].bvh_offset = static_cast<uint32_t>(cooked_size);
+		parts[i].bvh_size = static_cast<uint32_t>(bvh_blobs[i].size());
+		cooked_size += bvh_blobs[i].size();
+	}
+	std::vector<char> cooked(cooked_size);
+	memcpy(cooked.data(), &header, sizeof(header));
+	memcpy(cooked.data() + sizeof(header), parts.data(), parts.size() * sizeof(cooked_part));
+	memcpy(cooked.data() + header.vertices_offset, vertices.data(), vertices.size() * sizeof(vertex));
+	memcpy(cooked.data() + header.indices_offset, indices.data(), indices.size() * sizeof(uint32_t));
+	memcpy(cooked.data() + header.physics_offset, physics_positions.data(), physics_positions.size() * sizeof(float));
+	for (size_t i = 0; i < parts.size(); i++) memcpy(cooked.data() + parts[i].bvh_offset, bvh_blobs[i].data(), bvh_blobs[i].size());
+	return cooked;
+}
+
+bool cw::meshes::prepare_cooked(pending_prop &target, std::shared_ptr<const void> storage, char *data, size_t size) {
+	if (size < sizeof(cooked_header)) return false;
+	cooked_header header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != cooked_magic || header.version != cooked_version || header.source_hash != target.source_hash) return false;
+	if (header.vertices_offset != sizeof(cooked_header) + header.num_parts * sizeof(cooked_part)) return false;
+	if (header.indices_offset != header.vertices_offset + header.num_vertices * sizeof(vertex)) return false;
+	if (header.physics_offset != align_cooked_offset(header.indices_offset + header.num_indices * sizeof(uint32_t))) return false;
+	if (size < header.physics_offset + header.num_vertices * sizeof(float) * 3) return false;
+	auto cooked_parts = reinterpret_cast<const cooked_part *>(data + sizeof(cooked_header));
+	auto cooked_indices = reinterpret_cast<const uint32_t *>(data + header.indices_offset);
+	auto cooked_physics_positions = reinterpret_cast<const float *>(data + header.physics_offset);
+	for (uint32_t part_index = 0; part_index < header.num_parts; part_index++) {
+		const auto &part = cooked_parts[part_index];
+		if (part.bvh_offset % 16 || static_cast<size_t>(part.bvh_offset) + part.bvh_size > size) return false;
+	}
+	target.header = header;
+	target.parts = cooked_parts;
+	target.vertices = reinterpret_cast<const vertex *>(data + header.vertices_offset);
+	target.indices = cooked_indices;
+	target.result.storage = storage;
+	target.result.aabb[0] = { header.aabb[0], header.aabb[1], header.aabb[2] };
+	target.result.aabb[1] = { header.aabb[3], header.aabb[4], header.aabb[5] };
+	for (uint32_t part_index = 0; part_index < header.num_parts; part_index++) {
+		const auto &part = cooked_parts[part_index];
+		mesh new_mesh;
+		new_mesh.first_index = part.first_index;
+		new_mesh.num_indices = part.num_indices;
+		new_mesh.base_vertex = part.base_vertex;
+		new_mesh.material_name = fmt::format("{}_mesh_{}", target.name, part_index);
+		new_mesh.aabb[0] = { part.aabb[0], part.aabb[1], part.aabb[2] };
+		new_mesh.aabb[1] = { part.aabb[3], part.aabb[4], part.aabb[5] };
+		new_mesh.triangle_index_vertex_array = make_triangle_index_vertex_array(part, cooked_physics_positions, cooked_indices);
+		new_mesh.triangle_mesh_shape = new btBvhTriangleMeshShape(new_mesh.triangle_index_vertex_array, true, false);
+		auto bvh = btOptimizedBvh::deSerializeInPlace(data + part.bvh_offset, part.bvh_size, false);
+		if (bvh) new_mesh.triangle_mesh_shape->setOptimizedBvh(static_cast<btOptimizedBvh *>(bvh));
+		else {
+			std::cout << "Rebuilding collision hierarchy for \"" << new_mesh.material_name << "\"." << std::endl;
+			new_mesh.triangle_mesh_shape->buildOptimizedBvh();
+		}
+		target.result.parts.push_back(new_mesh);
+	}
+	return true;
+}
+
+void cw::meshes::prepare_prop(pending_prop &target) {
+	auto source = pack::open(target.source_name);
+	if (!source) return;
+	target.source_hash = misc::fnv1a(source->data, source->size);
+	auto cooked_path = fmt::format("{}{}.{:016x}.mesh", target.cache_path, target.name, target.source_hash);
+	// Mapped copy-on-write because Bullet fixes up the BVH pointers in place.
+	if (auto cooked = misc::map_file(cooked_path, misc::access::sequential, true); cooked && prepare_cooked(target, cooked, cooked->view, cooked->size())) {
+		target.ready = true;
+		return;
+	}
+	auto cooked = cook(source->data, source->size, target.source_hash);
+	if (!cooked) {
+		std::cout << "Error while processing prop: " << target.source_name << std::endl;
+		return;
+	}
+	std::cout << "Cooked prop \"" << target.name << "\" from source." << std::endl;
+	misc::write_file(cooked_path, *cooked);
+	auto cooked_storage = std::make_shared<std::vector<char>>(std::move(*cooked));
+	target.ready = prepare_cooked(target, cooked_storage, cooked_storage->data(), cooked_storage->size());
+}
+
+void cw::meshes::finalize_prop(pending_prop &target) {
+	auto &new_prop = target.result;
+	// The headless server only keeps the collision shapes, buffers and materials are for drawing.
+#if !CW_HEADLESS
+	glGenVertexArrays(1, &new_prop.array);
+	assert(new_prop.array);
+	glGenBuffers(1, &new_prop.buffer);
+	assert(new_prop.buffer);
+	glGenBuffers(1, &new_prop.element_buffer);
+	assert(new_prop.element_buffer);
+	glBindVertexArray(new_prop.array);
+	glBindBuffer(GL_ARRAY_BUFFER, new_prop.buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, new_prop.element_buffer);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), 0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), reinterpret_cast<void *>(sizeof(float) * 3));
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), reinterpret_cast<void *>(sizeof(float) * 6));
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glBufferData(GL_ARRAY_BUFFER, target.header.num_vertices * sizeof(vertex), target.vertices, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, target.header.num_indices * sizeof(uint32_t), target.indices, GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	for (uint32_t part_index = 0; part_index < target.header.num_parts; part_index++) {
+		const auto &part = target.parts[part_index];
+		const auto &registered_material_name = new_prop.parts[part_index].material_name;
+		materials::registry[registered_material_name] = {
+			{ part.diffuse[0], part.diffuse[1], part.diffuse[2] }
+		};
+		std::cout << "Registered material \"" << registered_material_name << "\"." << std::endl;
+		std::string texture_name(part.texture_name, strnlen(part.texture_name, sizeof(part.texture_name)));
+		if (texture_name.empty()) continue;
+		if (auto texture = textures::registry.find(texture_name); texture != textures::registry.end()) {
+			materials::registry[registered_material_name].texture = texture->second.index;
+		} else std::cout << "Material \"" << registered_material_name << "\" wants missing texture \"" << texture_name << "\"." << std::endl;
+	}
+#endif
+	props[target.name] = new_prop;
+	std::cout << "Loaded prop \"" << target.name << "\". " << new_prop.parts.size() << " parts." << std::endl;
+}
+
+cw::jobs::task_handle cw::meshes::load_props(const jobs::task_handle &after, jobs::counter &progress) {
+	auto cache_path = sys::bin_path().string() + "cache\\prop\\";
+	std::filesystem::create_directories(cache_path);
+	// Listed in sorted order so materials are registered the same way on every machine.
+	auto source_names = pack::list("prop");
+	// Finalizing needs the texture registry, so it waits on `after`. Finalizers are chained so
+	// materials are registered in the same order no matter which prop finishes preparing first.
+	auto finished = jobs::make_task(nullptr);
+	auto previous_finalize = after;
+	for (auto &source_name : source_names) {
+		auto source_path = std::filesystem::path(source_name);
+		auto target = std::make_shared<pending_prop>();
+		target->name = source_path.parent_path().stem().string() + "_" + source_path.stem().string();
+		target->source_name = source_name;
+		target->cache_path = cache_path;
+		auto prepare = jobs::make_task([target]() { prepare_prop(*target); }, false, &progress);
+		auto finalize = jobs::make_task([target]() { if (target->ready) finalize_prop(*target); }, true, &progress);
+		jobs::depend(finalize, prepare);
+		if (previous_finalize) jobs::depend(finalize, previous_finalize);
+		jobs::depend(finished, finalize);
+		jobs::launch(prepare);
+		jobs::launch(finalize);
+		previous_finalize = finalize;
 	}
+	if (after) jobs::depend(finished, after);
+	jobs::launch(finished);
+	return finished;
 }
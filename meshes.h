@@ -1,23 +1,45 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 #include <glm/vec3.hpp>
+#include <BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h>
 
 #include "physics.h"
 
 namespace cw::meshes {
 	struct mesh {
-		unsigned int array = 0;
-		unsigned int buffer = 0;
-		unsigned int num_vertices = 0;
+		unsigned int first_index = 0;
+		unsigned int num_indices = 0;
+		int base_vertex = 0;
 		std::string material_name;
+		glm::vec3 aabb[2];
+		btTriangleIndexVertexArray *triangle_index_vertex_array = 0;
 		btBvhTriangleMeshShape *triangle_mesh_shape = 0;
 	};
 	struct prop {
+		unsigned int array = 0;
+		unsigned int buffer = 0;
+		unsigned int element_buffer = 0;
 		std::vector<mesh> parts;
 		glm::vec3 aabb[2];
+		std::shared_ptr<const void> storage;
+	};
+	// A prop standing somewhere in the world. Props with mass are loose and pushed around by physics.
+	struct placement {
+		std::string prop_name;
+		glm::vec3 location;
+		glm::quat orientation;
+		glm::vec3 scale;
+		float mass = 0;
 	};
 	extern std::map<std::string, prop> props;
+	// What every world is built from. The client and each match on the server place the same props, so
+	// a predicted character collides with what the server's does.
+	extern const std::vector<placement> layout;
+	btCollisionShape *make_collision_shape(const prop &source, const glm::vec3 &scale);
+	btCollisionObject *place(btDynamicsWorld *world, const placement &source, btMotionState *motion_state = 0);
+	btMotionState *remove(btCollisionWorld *world, btCollisionObject *object);
 }
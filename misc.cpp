@@ -1,6 +1,19 @@
 #include "misc.h"
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 std::optional<std::vector<char>> cw::misc::read_file(const std::filesystem::path &path) {
 	std::ifstream in(path.string(), std::ios::binary);
@@ -11,10 +24,7 @@ std::optional<std::vector<char>> cw::misc::read_file(const std::filesystem::path
 	std::vector<char> content(std::filesystem::file_size(path));
 	if (!content.size()) return std::vector<char>();
 	in.read(content.data(), content.size());
-	if (static_cast<size_t>(in.tellg()) == content.size()) {
-		std::cout << "File contents loaded: \"" << path.string() << "\" (" << content.size() << " bytes)" << std::endl;
-		return content;
-	}
+	if (static_cast<size_t>(in.tellg()) == content.size()) return content;
 	std::cout << "Unable to read entire file contents: \"" << path.string() << "\"." << std::endl;
 	return std::nullopt;
 }
@@ -45,3 +55,108 @@ std::optional<std::map<std::string, std::vector<std::string>>> cw::misc::map_fil
 	}
 	return map;
 }
+
+cw::misc::mapped_file::~mapped_file() {
+#ifdef _WIN32
+	if (mapped) UnmapViewOfFile(view);
+	if (mapping_handle) CloseHandle(mapping_handle);
+	if (file_handle && file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+#else
+	if (mapped) munmap(view, length);
+	if (descriptor != -1) close(descriptor);
+#endif
+}
+
+void cw::misc::advise(const mapped_file &file, access hint) {
+	if (!file.mapped || hint == access::normal) return;
+#ifdef _WIN32
+	// Windows has no random-access hint for views; sequential readers get the whole range prefetched.
+#if _WIN32_WINNT >= 0x0602
+	if (hint == access::sequential) {
+		WIN32_MEMORY_RANGE_ENTRY range { file.view, file.length };
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	}
+#endif
+#else
+	// Advice is one value per call, not a mask, so sequential readers ask twice.
+	if (hint == access::sequential) {
+		madvise(file.view, file.length, MADV_SEQUENTIAL);
+		madvise(file.view, file.length, MADV_WILLNEED);
+	} else madvise(file.view, file.length, MADV_RANDOM);
+#endif
+}
+
+std::shared_ptr<const cw::misc::mapped_file> cw::misc::map_file(const std::filesystem::path &path, access hint, bool copy_on_write) {
+	auto file = std::make_shared<mapped_file>();
+#ifdef _WIN32
+	file->file_handle = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, hint == access::sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, 0);
+	if (file->file_handle == INVALID_HANDLE_VALUE) return nullptr;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file->file_handle, &file_size) || !file_size.QuadPart) return nullptr;
+	file->length = static_cast<size_t>(file_size.QuadPart);
+	file->mapping_handle = CreateFileMappingW(file->file_handle, 0, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, 0);
+	if (file->mapping_handle) file->view = static_cast<char *>(MapViewOfFile(file->mapping_handle, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+#else
+	file->descriptor = open(path.string().c_str(), O_RDONLY);
+	if (file->descriptor == -1) return nullptr;
+	struct stat file_status;
+	if (fstat(file->descriptor, &file_status) != 0 || !file_status.st_size) return nullptr;
+	file->length = static_cast<size_t>(file_status.st_size);
+	void *view = mmap(0, file->length, copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, file->descriptor, 0);
+	if (view != MAP_FAILED) file->view = static_cast<char *>(view);
+#endif
+	if (file->view) {
+		file->mapped = true;
+		advise(*file, hint);
+		return file;
+	}
+	// Some files can't be mapped (pipes, certain network shares), so read them the slow way instead.
+	file->buffer.resize(file->length);
+	size_t total = 0;
+	while (total < file->length) {
+	#ifdef _WIN32
+		DWORD count = 0;
+		DWORD request = static_cast<DWORD>(std::min<size_t>(file->length - total, 1 << 30));
+		if (!ReadFile(file->file_handle, file->buffer.data() + total, request, &count, 0) || !count) break;
+	#else
+		auto count = read(file->descriptor, file->buffer.data() + total, file->length - total);
+		if (count <= 0) break;
+	#endif
+		total += static_cast<size_t>(count);
+	}
+	if (total != file->length) {
+		std::cout << "Unable to read entire file contents: \"" << path.string() << "\"." << std::endl;
+		return nullptr;
+	}
+	file->view = file->buffer.data();
+	return file;
+}
+
+uint64_t cw::misc::fnv1a(const void *data, size_t size) {
+	uint64_t hash = 14695981039346656037ull;
+	auto bytes = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Sleeps until shortly before the deadline and yields for the rest, because the OS routinely wakes
+// threads late. The yielding stretch grows whenever a sleep overshoots by more than it.
+void cw::misc::sleep_until(std::chrono::steady_clock::time_point deadline) {
+	static thread_local std::chrono::nanoseconds spin_window = std::chrono::microseconds(500);
+	while (true) {
+		auto now = std::chrono::steady_clock::now();
+		if (now >= deadline) return;
+		auto remaining = deadline - now;
+		if (remaining <= spin_window) {
+			std::this_thread::yield();
+			continue;
+		}
+		auto wanted = remaining - spin_window;
+		std::this_thread::sleep_for(wanted);
+		auto overslept = std::chrono::steady_clock::now() - now - wanted;
+		if (overslept > spin_window) spin_window = std::min<std::chrono::nanoseconds>(overslept + std::chrono::microseconds(250), std::chrono::milliseconds(4));
+	}
+}
@@ -4,9 +4,41 @@
 #include <string>
 #include <map>
 #include <filesystem>
+#include <memory>
+#include <cstdint>
+#include <chrono>
 
 namespace cw::misc {
+	enum class access {
+		normal,
+		sequential,
+		random
+	};
+	struct mapped_file {
+		char *view = 0;
+		size_t length = 0;
+		bool mapped = false;
+		std::vector<char> buffer;
+	#ifdef _WIN32
+		void *file_handle = 0;
+		void *mapping_handle = 0;
+	#else
+		int descriptor = -1;
+	#endif
+		mapped_file() = default;
+		mapped_file(const mapped_file &) = delete;
+		mapped_file &operator=(const mapped_file &) = delete;
+		~mapped_file();
+		const char *data() const { return view; }
+		size_t size() const { return length; }
+		const char *begin() const { return view; }
+		const char *end() const { return view + length; }
+	};
 	std::optional<std::vector<char>> read_file(const std::filesystem::path &path);
 	bool write_file(const std::filesystem::path &path, const std::vector<char> &data);
 	std::optional<std::map<std::string, std::vector<std::string>>> map_file_names_and_extensions(const std::filesystem::path &path);
+	std::shared_ptr<const mapped_file> map_file(const std::filesystem::path &path, access hint = access::normal, bool copy_on_write = false);
+	void advise(const mapped_file &file, access hint);
+	uint64_t fnv1a(const void *data, size_t size);
+	void sleep_until(std::chrono::steady_clock::time_point deadline);
 }
\ No newline at end of file
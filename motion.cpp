@@ -0,0 +1,164 @@
+#include "motion.h"
+
+#include <vector>
+#include <limits>
+#include <assert.h>
+#include <glm/glm.hpp>
+
+namespace cw::motion {
+	const uint32_t no_slot = std::numeric_limits<uint32_t>::max();
+	std::vector<std::weak_ptr<node>> targets;
+	std::vector<state *> states;
+	std::vector<int32_t> staged_index;
+	std::vector<uint8_t> moving;
+	std::vector<uint32_t> free_slots;
+	std::vector<uint32_t> moving_slots;
+	// Transforms Bullet reported since the last flush, one entry per body, still in Bullet's frame.
+	std::vector<uint32_t> staged_slots;
+	std::vector<float> staged_x, staged_y, staged_z;
+	std::vector<float> staged_qx, staged_qy, staged_qz, staged_qw;
+	void reserve_staging(size_t capacity);
+	void convert_vectors(float *y, float *z, size_t count);
+}
+
+void cw::motion::state::getWorldTransform(btTransform &out) const {
+	out = initial_transform;
+}
+
+// Called by Bullet for every awake body at the end of a step. A body reported twice before a flush,
+// as happens while rollback resimulates several ticks, keeps one staged entry with the newest transform.
+void cw::motion::state::setWorldTransform(const btTransform &in) {
+	int32_t &index = staged_index[slot];
+	if (index < 0) {
+		index = static_cast<int32_t>(staged_slots.size());
+		staged_slots.push_back(slot);
+		staged_x.emplace_back();
+		staged_y.emplace_back();
+		staged_z.emplace_back();
+		staged_qx.emplace_back();
+		staged_qy.emplace_back();
+		staged_qz.emplace_back();
+		staged_qw.emplace_back();
+	}
+	auto &origin = in.getOrigin();
+	auto rotation = in.getRotation();
+	staged_x[index] = origin.x();
+	staged_y[index] = origin.y();
+	staged_z[index] = origin.z();
+	staged_qx[index] = rotation.x();
+	staged_qy[index] = rotation.y();
+	staged_qz[index] = rotation.z();
+	staged_qw[index] = rotation.w();
+}
+
+void cw::motion::reserve_staging(size_t capacity) {
+	staged_slots.reserve(capacity);
+	staged_x.reserve(capacity);
+	staged_y.reserve(capacity);
+	staged_z.reserve(capacity);
+	staged_qx.reserve(capacity);
+	staged_qy.reserve(capacity);
+	staged_qz.reserve(capacity);
+	staged_qw.reserve(capacity);
+	moving_slots.reserve(capacity);
+}
+
+cw::motion::state *cw::motion::bind(const std::shared_ptr<node> &target) {
+	uint32_t slot;
+	if (free_slots.size()) {
+		slot = free_slots.back();
+		free_slots.pop_back();
+	} else {
+		slot = static_cast<uint32_t>(states.size());
+		targets.emplace_back();
+		states.push_back(0);
+		staged_index.push_back(-1);
+		moving.push_back(false);
+		reserve_staging(states.size());
+	}
+	auto motion_state = new state;
+	motion_state->slot = slot;
+	motion_state->initial_transform = btTransform(physics::to(target->orientation), physics::to(target->location));
+	targets[slot] = target;
+	states[slot] = motion_state;
+	moving[slot] = false;
+	target->location_interpolation_pair = { target->location, target->location };
+	target->orientation_interpolation_pair = { target->orientation, target->orientation };
+	return motion_state;
+}
+
+// The body using `motion_state` must already be out of the world.
+void cw::motion::unbind(state *motion_state) {
+	const uint32_t slot = motion_state->slot;
+	assert(states[slot] == motion_state);
+	if (staged_index[slot] >= 0) staged_slots[staged_index[slot]] = no_slot;
+	staged_index[slot] = -1;
+	moving[slot] = false;
+	targets[slot].reset();
+	states[slot] = 0;
+	free_slots.push_back(slot);
+	delete motion_state;
+}
+
+// Bullet is Y-up and the engine is Z-up, see physics::from. Kept as a plain loop over separate
+// component arrays, x never changes, so the compiler turns it into straight SIMD moves and negations.
+void cw::motion::convert_vectors(float *y, float *z, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		const float up = y[i];
+		y[i] = -z[i];
+		z[i] = up;
+	}
+}
+
+void cw::motion::flush() {
+	const size_t count = staged_slots.size();
+	convert_vectors(staged_y.data(), staged_z.data(), count);
+	// A rotation's axis turns with the frame like any other vector and its w is unaffected.
+	convert_vectors(staged_qy.data(), staged_qz.data(), count);
+	// Bodies that moved last step but were not reported this time went to sleep, so they stop between steps.
+	for (auto slot : moving_slots) {
+		if (!moving[slot] || staged_index[slot] >= 0) continue;
+		moving[slot] = false;
+		if (auto target = targets[slot].lock()) {
+			target->location_interpolation_pair.first = target->location = target->location_interpolation_pair.second;
+			target->orientation_interpolation_pair.first = target->orientation = target->orientation_interpolation_pair.second;
+			target->needs_local_update = true;
+		}
+	}
+	moving_slots.clear();
+	for (size_t i = 0; i < count; i++) {
+		const uint32_t slot = staged_slots[i];
+		if (slot == no_slot) continue;
+		staged_index[slot] = -1;
+		auto target = targets[slot].lock();
+		if (!target) continue;
+		moving[slot] = true;
+		moving_slots.push_back(slot);
+		target->location_interpolation_pair.first = target->location_interpolation_pair.second;
+		target->location_interpolation_pair.second = { staged_x[i], staged_y[i], staged_z[i] };
+		target->orientation_interpolation_pair.first = target->orientation_interpolation_pair.second;
+		target->orientation_interpolation_pair.second = glm::quat(staged_qw[i], staged_qx[i], staged_qy[i], staged_qz[i]);
+	}
+	staged_slots.clear();
+	staged_x.clear();
+	staged_y.clear();
+	staged_z.clear();
+	staged_qx.clear();
+	staged_qy.clear();
+	staged_qz.clear();
+	staged_qw.clear();
+}
+
+void cw::motion::interpolate(float alpha) {
+	for (auto slot : moving_slots) {
+		auto target = targets[slot].lock();
+		if (!target) continue;
+		target->location = glm::mix(target->location_interpolation_pair.first, target->location_interpolation_pair.second, alpha);
+		target->orientation = glm::slerp(target->orientation_interpolation_pair.first, target->orientation_interpolation_pair.second, alpha);
+		target->needs_local_update = true;
+	}
+}
+
+size_t cw::motion::num_moving() {
+	return moving_slots.size();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "physics.h"
+#include "node.h"
+
+// Connects rigid bodies to scene nodes. Bullet hands the bridge the transform of every body that was
+// awake during a step, `flush` converts those to engine space together and pushes them into the
+// nodes' interpolation pairs, and `interpolate` places the nodes between the last two steps once per
+// frame. Sleeping bodies cost nothing in any of the three.
+
+namespace cw::motion {
+	struct state : btMotionState {
+		uint32_t slot = 0;
+		btTransform initial_transform;
+		void getWorldTransform(btTransform &out) const override;
+		void setWorldTransform(const btTransform &in) override;
+	};
+	state *bind(const std::shared_ptr<node> &target);
+	void unbind(state *motion_state);
+	void flush();
+	void interpolate(float alpha);
+	size_t num_moving();
+}
@@ -5,89 +5,110 @@
 #include <algorithm>
 #include <assert.h>
 
-ENetHost *cw::net::local_host = 0;
-cw::net::state cw::net::current_state = cw::net::state::idle;
+cw::net::host cw::net::default_host;
 
-namespace cw::net {
-	std::vector<ENetPeer *> active_peers;
-}
-
-void cw::net::become_server(uint16_t port) {
-	shutdown();
+void cw::net::become_server(host &target, uint16_t port, size_t max_peers) {
+	shutdown(target);
 	ENetAddress address;
 	address.host = ENET_HOST_ANY;
 	address.port = port;
-	local_host = enet_host_create(&address, 32, 2, 0, 0);
-	if (!local_host) {
+	target.local_host = enet_host_create(&address, max_peers, 2, 0, 0);
+	if (!target.local_host) {
 		std::cout << "Unable to create local host. Perhaps that port is already in use?" << std::endl;
 		return;
 	}
 	std::cout << "Listening for connections on port " << port << "." << std::endl;
-	current_state = state::server;
-
+	target.current_state = state::server;
 }
 
-void cw::net::start_connection_attempt(std::string ip_address, uint16_t port) {
-	shutdown();
-	local_host = enet_host_create(0, 1, 2, 0, 0);
-	assert(local_host);
+void cw::net::start_connection_attempt(host &target, std::string ip_address, uint16_t port) {
+	shutdown(target);
+	target.local_host = enet_host_create(0, 1, 2, 0, 0);
+	assert(target.local_host);
 	ENetAddress address;
 	if (enet_address_set_host(&address, ip_address.c_str()) != 0) {
 		std::cout << "Connection attempt cancelled; unable to resolve host name." << std::endl;
-		shutdown();
+		shutdown(target);
 		return;
 	}
 	address.port = port;
-	if (!enet_host_connect(local_host, &address, 2, 0)) {
+	if (!enet_host_connect(target.local_host, &address, 2, 0)) {
 		std::cout << "Connection attempt cancelled; no space available for more peers." << std::endl;
-		shutdown();
+		shutdown(target);
 		return;
 	}
-	current_state = state::connecting;
+	target.current_state = state::connecting;
 }
 
-void cw::net::shutdown() {
-	if (local_host) {
-		for (auto peer : active_peers) enet_peer_disconnect(peer, 0);
-		enet_host_flush(local_host);
-		enet_host_destroy(local_host);
+void cw::net::shutdown(host &target) {
+	if (target.local_host) {
+		for (auto peer : target.active_peers) enet_peer_disconnect(peer, 0);
+		enet_host_flush(target.local_host);
+		enet_host_destroy(target.local_host);
 		std::cout << "Destroyed local network host." << std::endl;
-		local_host = 0;
+		target.local_host = 0;
 	}
-	active_peers.clear();
-	current_state = state::idle;
+	target.active_peers.clear();
+	target.current_state = state::idle;
 }
 
-void cw::net::process() {
-	if (!local_host) return;
+void cw::net::process(host &target) {
+	if (!target.local_host) return;
 	ENetEvent net_event;
-	while (enet_host_service(local_host, &net_event, 0) != 0) {
+	while (enet_host_service(target.local_host, &net_event, 0) != 0) {
+		if (target.observer) target.observer(net_event);
 		if (net_event.type == ENET_EVENT_TYPE_CONNECT) {
-			active_peers.push_back(net_event.peer);
-			if (current_state == state::connecting) {
+			target.active_peers.push_back(net_event.peer);
+			if (target.on_peer) target.on_peer(net_event.peer, true);
+			if (target.current_state == state::connecting) {
 				std::cout << "Connection to server established. Transitioning to client mode." << std::endl;
-				current_state = state::client;
+				target.current_state = state::client;
 			} else {
 				std::cout << "Peer connected. ";
-				if (!active_peers.size()) std::cout << "No peers are connected." << std::endl;
-				else std::cout << active_peers.size() << " peer" << (active_peers.size() == 1 ? " is " : "s are ") << "connected." << std::endl;
+				if (!target.active_peers.size()) std::cout << "No peers are connected." << std::endl;
+				else std::cout << target.active_peers.size() << " peer" << (target.active_peers.size() == 1 ? " is " : "s are ") << "connected." << std::endl;
 			}
+		} else if (net_event.type == ENET_EVENT_TYPE_RECEIVE) {
+			if (target.on_receive) target.on_receive(net_event.peer, net_event.packet->data, net_event.packet->dataLength);
+			enet_packet_destroy(net_event.packet);
 		} else if (net_event.type == ENET_EVENT_TYPE_DISCONNECT) {
+			if (target.on_peer) target.on_peer(net_event.peer, false);
 			enet_peer_reset(net_event.peer);
-			active_peers.erase(std::remove(active_peers.begin(), active_peers.end(), net_event.peer), active_peers.end());
-			if (current_state == state::client) {
+			target.active_peers.erase(std::remove(target.active_peers.begin(), target.active_peers.end(), net_event.peer), target.active_peers.end());
+			if (target.current_state == state::client) {
 				std::cout << "Connection to the server has been disconnected." << std::endl;
-				shutdown();
+				shutdown(target);
 				return;
-			} else if (current_state == state::connecting) {
+			} else if (target.current_state == state::connecting) {
 				std::cout << "Attempt to connect to the server has failed." << std::endl;
-				shutdown();
+				shutdown(target);
 				return;
 			} else {
 				std::cout << "Peer disconnected. ";
-				if (!active_peers.size()) std::cout << "No peers are connected." << std::endl;
-				else std::cout << active_peers.size() << " peer" << (active_peers.size() == 1 ? " is " : "s are ") << "connected." << std::endl;
+				if (!target.active_peers.size()) std::cout << "No peers are connected." << std::endl;
+				else std::cout << target.active_peers.size() << " peer" << (target.active_peers.size() == 1 ? " is " : "s are ") << "connected." << std::endl;
 			}
 		}
 	}
 }
+
+// A recorded event, handled the way `process` handled it live as far as the rest of the game can
+// tell. Replays have no socket, so `peer` is a stand-in that's never connected and drops whatever is
+// sent to it. `role` is what the host was when it was recorded, a server stays one as peers come and
+// go, a client goes back to idle when its server does.
+void cw::net::play_event(host &target, state role, ENetEventType type, ENetPeer *peer, const uint8_t *data, size_t size) {
+	if (type == ENET_EVENT_TYPE_CONNECT) {
+		target.active_peers.push_back(peer);
+		if (target.on_peer) target.on_peer(peer, true);
+		target.current_state = role;
+	} else if (type == ENET_EVENT_TYPE_RECEIVE) {
+		if (target.on_receive) target.on_receive(peer, data, size);
+	} else if (type == ENET_EVENT_TYPE_DISCONNECT) {
+		if (target.on_peer) target.on_peer(peer, false);
+		target.active_peers.erase(std::remove(target.active_peers.begin(), target.active_peers.end(), peer), target.active_peers.end());
+		if (role == state::client) {
+			target.active_peers.clear();
+			target.current_state = state::idle;
+		}
+	}
+}
@@ -2,6 +2,8 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
+#include <functional>
 #include <enet/enet.h>
 
 namespace cw::net {
@@ -11,10 +13,21 @@ namespace cw::net {
 		client,
 		connecting
 	};
-	extern ENetHost *local_host;
-	extern state current_state;
-	void become_server(uint16_t port);
-	void start_connection_attempt(std::string ip_address, uint16_t port);
-	void shutdown();
-	void process();
+	// One ENet endpoint and its peers. The client uses `default_host`, a server process keeps one per match.
+	struct host {
+		ENetHost *local_host = 0;
+		state current_state = state::idle;
+		std::vector<ENetPeer *> active_peers;
+		// Sees every event before it's handled, for recording the match.
+		std::function<void(const ENetEvent &)> observer;
+		std::function<void(ENetPeer *peer, bool connected)> on_peer;
+		// The packet is destroyed once this returns.
+		std::function<void(ENetPeer *peer, const uint8_t *data, size_t size)> on_receive;
+	};
+	extern host default_host;
+	void become_server(host &target, uint16_t port, size_t max_peers = 32);
+	void start_connection_attempt(host &target, std::string ip_address, uint16_t port);
+	void shutdown(host &target);
+	void process(host &target);
+	void play_event(host &target, state role, ENetEventType type, ENetPeer *peer, const uint8_t *data, size_t size);
 }
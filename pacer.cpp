@@ -0,0 +1,83 @@
+#include "pacer.h"
+#include "misc.h"
+
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <timeapi.h>
+#endif
+
+namespace cw::pacer {
+	// How often `while_waiting` runs during a long wait.
+	const auto idle_interval = std::chrono::milliseconds(1);
+	// Added on top of the measured late work so ordinary frame to frame jitter doesn't make us miss.
+	const double late_work_margin_ms = 0.5;
+	bool fine_timer = false;
+	bool waiting_frame = false;
+	std::chrono::steady_clock::duration period { 0 };
+	std::chrono::steady_clock::time_point deadline;
+	std::chrono::steady_clock::time_point late_work_start;
+	size_t error_history_cursor = 0;
+}
+
+double cw::pacer::target_fps = 0;
+double cw::pacer::last_error_ms = 0;
+double cw::pacer::mean_absolute_error_ms = 0;
+double cw::pacer::late_work_estimate_ms = 2;
+float cw::pacer::error_history[error_history_length] = { 0 };
+
+// A target of 0 turns pacing off and leaves it to vsync.
+void cw::pacer::configure(double target_fps) {
+	pacer::target_fps = std::max(0.0, target_fps);
+	period = pacer::target_fps > 0 ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / pacer::target_fps)) : std::chrono::steady_clock::duration(0);
+	deadline = std::chrono::steady_clock::now() + period;
+#ifdef _WIN32
+	if (pacer::target_fps > 0 && !fine_timer) {
+		timeBeginPeriod(1);
+		fine_timer = true;
+	}
+#endif
+}
+
+void cw::pacer::shutdown() {
+#ifdef _WIN32
+	if (fine_timer) timeEndPeriod(1);
+#endif
+	fine_timer = false;
+}
+
+void cw::pacer::wait_for_late_work(const std::function<void()> &while_waiting) {
+	if (target_fps <= 0) return;
+	auto now = std::chrono::steady_clock::now();
+	// After a hitch, start over from now instead of rushing frames out to catch up with old deadlines.
+	if (now > deadline) deadline = now + period;
+	auto late_work = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(late_work_estimate_ms + late_work_margin_ms));
+	const auto late_work_deadline = deadline - late_work;
+	if (while_waiting) {
+		while ((now = std::chrono::steady_clock::now()) < late_work_deadline) {
+			misc::sleep_until(std::min(late_work_deadline, now + idle_interval));
+			while_waiting();
+		}
+	} else misc::sleep_until(late_work_deadline);
+	late_work_start = std::chrono::steady_clock::now();
+	waiting_frame = true;
+}
+
+void cw::pacer::frame_presented() {
+	if (!waiting_frame) return;
+	waiting_frame = false;
+	auto now = std::chrono::steady_clock::now();
+	const double late_work_ms = std::chrono::duration<double, std::milli>(now - late_work_start).count();
+	// Jumps straight up to a slower frame and only creeps back down, late is worse than a little early.
+	late_work_estimate_ms = std::max(late_work_ms, late_work_estimate_ms * 0.98 + late_work_ms * 0.02);
+	last_error_ms = std::chrono::duration<double, std::milli>(now - deadline).count();
+	mean_absolute_error_ms += (std::abs(last_error_ms) - mean_absolute_error_ms) * 0.05;
+	error_history[error_history_cursor] = static_cast<float>(last_error_ms);
+	error_history_cursor = (error_history_cursor + 1) % error_history_length;
+	deadline += period;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// Frame limiter for running without vsync. Each frame has a deadline one period after the last.
+// `wait_for_late_work` holds the main thread until just enough time is left to sample input, update
+// the camera and draw before the deadline, and `frame_presented` measures how far off it was.
+
+namespace cw::pacer {
+	const size_t error_history_length = 120;
+	extern double target_fps;
+	extern double last_error_ms;
+	extern double mean_absolute_error_ms;
+	extern double late_work_estimate_ms;
+	extern float error_history[error_history_length];
+	void configure(double target_fps);
+	void shutdown();
+	void wait_for_late_work(const std::function<void()> &while_waiting = nullptr);
+	void frame_presented();
+}
@@ -0,0 +1,233 @@
+#include "pack.h"
+#include "misc.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <zlib.h>
+
+namespace cw::pack {
+	// A pack is a header, the entry data, a directory index sorted by name hash, then the name table.
+	const uint32_t pack_magic = 0x4b505743;
+	const uint32_t pack_version = 1;
+	const uint32_t compression_none = 0;
+	const uint32_t compression_zlib = 1;
+	const size_t page_alignment = 4096;
+	const size_t page_aligned_threshold = 64 * 1024;
+	const size_t default_alignment = 16;
+	struct pack_header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t num_entries;
+		uint32_t reserved;
+		uint64_t index_offset;
+		uint64_t names_offset;
+	};
+	struct pack_entry {
+		uint64_t name_hash;
+		uint32_t name_offset;
+		uint32_t name_length;
+		uint64_t offset;
+		uint64_t stored_size;
+		uint64_t size;
+		uint32_t compression;
+		uint32_t reserved;
+	};
+	static_assert(sizeof(pack_header) == 32);
+	static_assert(sizeof(pack_entry) == 48);
+	std::filesystem::path loose_root;
+	std::shared_ptr<const misc::mapped_file> mapping;
+	const pack_entry *entries = 0;
+	const char *names = 0;
+	uint32_t num_entries = 0;
+	std::string_view entry_name(const pack_entry &entry);
+	const pack_entry *find(const std::string &name);
+	bool should_compress(const std::filesystem::path &path);
+}
+
+void cw::pack::initialize(const std::filesystem::path &root) {
+	loose_root = root;
+}
+
+std::string_view cw::pack::entry_name(const pack_entry &entry) {
+	return std::string_view(names + entry.name_offset, entry.name_length);
+}
+
+bool cw::pack::mount(const std::filesystem::path &path) {
+	unmount();
+	// Entries are looked up all over the archive, so don't let the kernel read ahead.
+	auto file = misc::map_file(path, misc::access::random);
+	if (!file) return false;
+	if (file->size() < sizeof(pack_header)) return false;
+	pack_header header;
+	memcpy(&header, file->data(), sizeof(header));
+	if (header.magic != pack_magic || header.version != pack_version) {
+		std::cout << "Ignoring asset pack with unknown format: \"" << path.string() << "\"" << std::endl;
+		return false;
+	}
+	if (header.index_offset % alignof(pack_entry) || header.index_offset + header.num_entries * sizeof(pack_entry) > file->size()) return false;
+	if (header.names_offset > file->size()) return false;
+	auto index = reinterpret_cast<const pack_entry *>(file->data() + header.index_offset);
+	for (uint32_t i = 0; i < header.num_entries; i++) {
+		if (index[i].offset + index[i].stored_size > file->size()) return false;
+		if (header.names_offset + index[i].name_offset + index[i].name_length > file->size()) return false;
+	}
+	mapping = file;
+	entries = index;
+	names = file->data() + header.names_offset;
+	num_entries = header.num_entries;
+	std::cout << "Mounted asset pack: \"" << path.string() << "\" (" << num_entries << " entries)" << std::endl;
+	return true;
+}
+
+void cw::pack::unmount() {
+	mapping.reset();
+	entries = 0;
+	names = 0;
+	num_entries = 0;
+}
+
+bool cw::pack::is_mounted() {
+	return mapping != nullptr;
+}
+
+const cw::pack::pack_entry *cw::pack::find(const std::string &name) {
+	if (!mapping) return 0;
+	const uint64_t hash = misc::fnv1a(name.data(), name.size());
+	auto first = std::lower_bound(entries, entries + num_entries, hash, [](const pack_entry &entry, uint64_t value) { return entry.name_hash < value; });
+	for (auto i = first; i != entries + num_entries && i->name_hash == hash; i++) if (entry_name(*i) == name) return i;
+	return 0;
+}
+
+std::optional<cw::pack::asset> cw::pack::open(const std::string &name) {
+	if (auto entry = find(name); entry) {
+		asset result;
+		if (entry->compression == compression_none) {
+			result.data = mapping->data() + entry->offset;
+			result.size = entry->size;
+			result.owner = mapping;
+			return result;
+		}
+		auto content = std::make_shared<std::vector<char>>(entry->size);
+		uLongf content_size = static_cast<uLongf>(entry->size);
+		if (uncompress(reinterpret_cast<Bytef *>(content->data()), &content_size, reinterpret_cast<const Bytef *>(mapping->data() + entry->offset), static_cast<uLong>(entry->stored_size)) != Z_OK || content_size != entry->size) {
+			std::cout << "Failed to decompress packed asset: \"" << name << "\"" << std::endl;
+			return std::nullopt;
+		}
+		result.data = content->data();
+		result.size = content->size();
+		result.owner = content;
+		return result;
+	}
+	auto file = misc::map_file(loose_root / name, misc::access::sequential);
+	if (!file) return std::nullopt;
+	asset result;
+	result.data = file->data();
+	result.size = file->size();
+	result.owner = file;
+	return result;
+}
+
+std::vector<std::string> cw::pack::list(const std::string &directory) {
+	std::vector<std::string> result;
+	const std::string prefix = directory + "/";
+	if (mapping) {
+		for (uint32_t i = 0; i < num_entries; i++) {
+			auto name = entry_name(entries[i]);
+			if (name.compare(0, prefix.size(), prefix) == 0) result.emplace_back(name);
+		}
+	} else if (std::filesystem::is_directory(loose_root / directory)) {
+		for (auto &file : std::filesystem::recursive_directory_iterator(loose_root / directory)) {
+			if (!file.is_regular_file()) continue;
+			result.push_back(std::filesystem::relative(file.path(), loose_root).generic_string());
+		}
+	}
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+std::optional<std::map<std::string, std::vector<std::string>>> cw::pack::map_file_names_and_extensions(const std::string &directory) {
+	auto names = list(directory);
+	if (names.empty()) return std::nullopt;
+	std::map<std::string, std::vector<std::string>> map;
+	for (auto &name : names) {
+		std::filesystem::path path(name);
+		if (path.parent_path().generic_string() != directory) continue;
+		if (!path.has_extension()) continue;
+		map[path.stem().string()].push_back(path.extension().string());
+	}
+	return map;
+}
+
+bool cw::pack::should_compress(const std::filesystem::path &path) {
+	auto extension = path.extension().string();
+	return extension != ".png" && extension != ".ogg";
+}
+
+bool cw::pack::build(const std::filesystem::path &root, const std::vector<std::string> &directories, const std::filesystem::path &output) {
+	struct pending_entry {
+		std::string name;
+		pack_entry entry;
+		std::vector<char> stored;
+	};
+	std::vector<pending_entry> pending;
+	for (auto &directory : directories) {
+		if (!std::filesystem::is_directory(root / directory)) continue;
+		for (auto &file : std::filesystem::recursive_directory_iterator(root / directory)) {
+			if (!file.is_regular_file()) continue;
+			auto content = misc::read_file(file.path());
+			if (!content) return false;
+			pending_entry new_entry;
+			new_entry.name = std::filesystem::relative(file.path(), root).generic_string();
+			memset(&new_entry.entry, 0, sizeof(new_entry.entry));
+			new_entry.entry.name_hash = misc::fnv1a(new_entry.name.data(), new_entry.name.size());
+			new_entry.entry.size = content->size();
+			new_entry.entry.compression = compression_none;
+			if (should_compress(file.path()) && !content->empty()) {
+				std::vector<char> compressed(compressBound(static_cast<uLong>(content->size())));
+				uLongf compressed_size = static_cast<uLongf>(compressed.size());
+				if (compress2(reinterpret_cast<Bytef *>(compressed.data()), &compressed_size, reinterpret_cast<const Bytef *>(content->data()), static_cast<uLong>(content->size()), Z_BEST_COMPRESSION) == Z_OK && compressed_size < content->size() - content->size() / 10) {
+					compressed.resize(compressed_size);
+					new_entry.stored = std::move(compressed);
+					new_entry.entry.compression = compression_zlib;
+				}
+			}
+			if (new_entry.entry.compression == compression_none) new_entry.stored = std::move(*content);
+			new_entry.entry.stored_size = new_entry.stored.size();
+			pending.push_back(std::move(new_entry));
+		}
+	}
+	std::sort(pending.begin(), pending.end(), [](const pending_entry &a, const pending_entry &b) {
+		if (a.entry.name_hash != b.entry.name_hash) return a.entry.name_hash < b.entry.name_hash;
+		return a.name < b.name;
+	});
+	auto align = [](size_t offset, size_t alignment) { return (offset + alignment - 1) & ~(alignment - 1); };
+	size_t offset = sizeof(pack_header);
+	std::string name_table;
+	for (auto &p : pending) {
+		const bool page_aligned = p.entry.compression == compression_none && p.stored.size() >= page_aligned_threshold;
+		offset = align(offset, page_aligned ? page_alignment : default_alignment);
+		p.entry.offset = offset;
+		offset += p.stored.size();
+		p.entry.name_offset = static_cast<uint32_t>(name_table.size());
+		p.entry.name_length = static_cast<uint32_t>(p.name.size());
+		name_table += p.name;
+	}
+	pack_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = pack_magic;
+	header.version = pack_version;
+	header.num_entries = static_cast<uint32_t>(pending.size());
+	header.index_offset = align(offset, default_alignment);
+	header.names_offset = header.index_offset + pending.size() * sizeof(pack_entry);
+	std::vector<char> packed(header.names_offset + name_table.size());
+	memcpy(packed.data(), &header, sizeof(header));
+	for (size_t i = 0; i < pending.size(); i++) {
+		if (!pending[i].stored.empty()) memcpy(packed.data() + pending[i].entry.offset, pending[i].stored.data(), pending[i].stored.size());
+		memcpy(packed.data() + header.index_offset + i * sizeof(pack_entry), &pending[i].entry, sizeof(pack_entry));
+	}
+	memcpy(packed.data() + header.names_offset, name_table.data(), name_table.size());
+	std::cout << "Packed " << pending.size() << " assets." << std::endl;
+	return misc::write_file(output, packed);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+namespace cw::pack {
+	struct asset {
+		const char *data = 0;
+		size_t size = 0;
+		std::shared_ptr<const void> owner;
+	};
+	void initialize(const std::filesystem::path &loose_root);
+	bool mount(const std::filesystem::path &path);
+	void unmount();
+	bool is_mounted();
+	std::optional<asset> open(const std::string &name);
+	std::vector<std::string> list(const std::string &directory);
+	std::optional<std::map<std::string, std::vector<std::string>>> map_file_names_and_extensions(const std::string &directory);
+	bool build(const std::filesystem::path &root, const std::vector<std::string> &directories, const std::filesystem::path &output);
+}
@@ -0,0 +1,15 @@
+#include "pack.h"
+
+#include <iostream>
+
+int main(int c, char **v) {
+	if (c < 3) {
+		std::cout << "Usage: cubewar-pack <asset directory> <output file>" << std::endl;
+		return 1;
+	}
+	if (!cw::pack::build(v[1], { "glsl", "prop", "texture" }, v[2])) {
+		std::cout << "Failed to build asset pack: \"" << v[2] << "\"" << std::endl;
+		return 2;
+	}
+	return 0;
+}
@@ -1,40 +1,149 @@
 #include "physics.h"
+#include "cfg.h"
+#include "jobs.h"
 
 #include <glm/vec3.hpp>
 #include <glm/gtc/quaternion.hpp>
+#include <BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
+#include <LinearMath/btThreads.h>
+#include <iostream>
+#include <algorithm>
+#include <mutex>
+#include <assert.h>
 
 namespace cw::physics {
-	btDefaultCollisionConfiguration *collision_configuration = 0;
-	btCollisionDispatcher *collision_dispatcher = 0;
-	btBroadphaseInterface *broadphase_interface = 0;
-	btSequentialImpulseConstraintSolver *constraint_solver = 0;
+	struct job_task_scheduler : btITaskScheduler {
+		int num_threads = 1;
+		job_task_scheduler(int num_threads);
+		int getMaxNumThreads() const override;
+		int getNumThreads() const override;
+		void setNumThreads(int num_threads) override;
+		void parallelFor(int begin, int end, int grain_size, const btIParallelForBody &body) override;
+		btScalar parallelSum(int begin, int end, int grain_size, const btIParallelSumBody &body) override;
+	};
+	int num_threads = 0;
+	world default_world;
+	job_task_scheduler *task_scheduler = 0;
 	void initialize();
 	void shutdown();
+	void step(const double &delta);
 }
 
 btDiscreteDynamicsWorld *cw::physics::dynamics_world = 0;
 
+cw::physics::job_task_scheduler::job_task_scheduler(int num_threads) : btITaskScheduler("cw::jobs") {
+	setNumThreads(num_threads);
+}
+
+int cw::physics::job_task_scheduler::getMaxNumThreads() const {
+	return std::min<int>(static_cast<int>(jobs::num_workers()) + 1, BT_MAX_THREAD_COUNT);
+}
+
+int cw::physics::job_task_scheduler::getNumThreads() const {
+	return num_threads;
+}
+
+void cw::physics::job_task_scheduler::setNumThreads(int num_threads) {
+	this->num_threads = std::max(1, std::min(num_threads, getMaxNumThreads()));
+}
+
+void cw::physics::job_task_scheduler::parallelFor(int begin, int end, int grain_size, const btIParallelForBody &body) {
+	jobs::parallel_for(begin, end, grain_size, [&body](size_t chunk_begin, size_t chunk_end) {
+		body.forLoop(static_cast<int>(chunk_begin), static_cast<int>(chunk_end));
+	}, num_threads);
+}
+
+btScalar cw::physics::job_task_scheduler::parallelSum(int begin, int end, int grain_size, const btIParallelSumBody &body) {
+	std::mutex sum_mutex;
+	btScalar sum = 0;
+	jobs::parallel_for(begin, end, grain_size, [&body, &sum_mutex, &sum](size_t chunk_begin, size_t chunk_end) {
+		auto partial_sum = body.sumLoop(static_cast<int>(chunk_begin), static_cast<int>(chunk_end));
+		std::lock_guard<std::mutex> lock(sum_mutex);
+		sum += partial_sum;
+	}, num_threads);
+	return sum;
+}
+
+// 0 in the configuration means every thread the job system has, 1 keeps the original single threaded world.
+int cw::physics::configured_threads() {
+	auto &system_cfg = cfg["system"];
+	if (system_cfg.find("physics_threads") == system_cfg.end()) system_cfg["physics_threads"] = num_threads;
+	num_threads = system_cfg["physics_threads"];
+	return num_threads > 0 ? num_threads : static_cast<int>(jobs::num_workers()) + 1;
+}
+
+// The client's single world, reachable through `dynamics_world`.
 void cw::physics::initialize() {
 	shutdown();
-	collision_configuration = new btDefaultCollisionConfiguration;
-	collision_dispatcher = new btCollisionDispatcher(collision_configuration);
-	broadphase_interface = new btDbvtBroadphase;
-	constraint_solver = new btSequentialImpulseConstraintSolver;
-	dynamics_world = new btDiscreteDynamicsWorld(collision_dispatcher, broadphase_interface, constraint_solver, collision_configuration);
-	dynamics_world->setGravity({ 0, -15, 0 });
+	create_world(default_world, configured_threads());
+	dynamics_world = default_world.dynamics_world;
 }
 
 void cw::physics::shutdown() {
-	if (dynamics_world) delete dynamics_world;
-	if (constraint_solver) delete constraint_solver;
-	if (broadphase_interface) delete broadphase_interface;
-	if (collision_dispatcher) delete collision_dispatcher;
-	if (collision_configuration) delete collision_configuration;
+	destroy_world(default_world);
 	dynamics_world = 0;
-	constraint_solver = 0;
-	broadphase_interface = 0;
-	collision_dispatcher = 0;
-	collision_configuration = 0;
+	if (task_scheduler) {
+		btSetTaskScheduler(0);
+		delete task_scheduler;
+	}
+	task_scheduler = 0;
+}
+
+void cw::physics::create_world(world &target, int num_threads) {
+	destroy_world(target);
+#if BT_THREADSAFE
+	if (num_threads > 1) {
+		// Bullet only has one scheduler per process, it is made for the first multithreaded world.
+		if (!task_scheduler) {
+			task_scheduler = new job_task_scheduler(num_threads);
+			btSetTaskScheduler(task_scheduler);
+		}
+		btDefaultCollisionConstructionInfo construction_info;
+		construction_info.m_defaultMaxPersistentManifoldPoolSize = 80000;
+		construction_info.m_defaultMaxCollisionAlgorithmPoolSize = 80000;
+		target.collision_configuration = new btDefaultCollisionConfiguration(construction_info);
+		target.collision_dispatcher = new btCollisionDispatcherMt(target.collision_configuration, 40);
+		target.broadphase_interface = new btDbvtBroadphase;
+		target.constraint_solver_pool = new btConstraintSolverPoolMt(task_scheduler->getNumThreads());
+		target.constraint_solver = new btSequentialImpulseConstraintSolverMt;
+		target.dynamics_world = new btDiscreteDynamicsWorldMt(target.collision_dispatcher, target.broadphase_interface, target.constraint_solver_pool, target.constraint_solver, target.collision_configuration);
+		std::cout << "Physics world is multithreaded. (" << task_scheduler->getNumThreads() << " threads)" << std::endl;
+	}
+#else
+	if (num_threads > 1) std::cout << "Bullet was built without BT_THREADSAFE, physics will run on one thread." << std::endl;
+#endif
+	if (!target.dynamics_world) {
+		target.collision_configuration = new btDefaultCollisionConfiguration;
+		target.collision_dispatcher = new btCollisionDispatcher(target.collision_configuration);
+		target.broadphase_interface = new btDbvtBroadphase;
+		target.constraint_solver = new btSequentialImpulseConstraintSolver;
+		target.dynamics_world = new btDiscreteDynamicsWorld(target.collision_dispatcher, target.broadphase_interface, target.constraint_solver, target.collision_configuration);
+	}
+	target.dynamics_world->setGravity({ 0, -15, 0 });
+	// Motion states receive the transform the step ended on, cw::motion does its own interpolation.
+	target.dynamics_world->setLatencyMotionStateInterpolation(false);
+}
+
+void cw::physics::destroy_world(world &target) {
+	if (target.dynamics_world) delete target.dynamics_world;
+	if (target.constraint_solver) delete target.constraint_solver;
+	if (target.constraint_solver_pool) delete target.constraint_solver_pool;
+	if (target.broadphase_interface) delete target.broadphase_interface;
+	if (target.collision_dispatcher) delete target.collision_dispatcher;
+	if (target.collision_configuration) delete target.collision_configuration;
+	target = world();
+}
+
+// The one place a world is advanced, shared by the game's fixed step, the server and the benchmarks.
+void cw::physics::step(world &target, const double &delta) {
+	[[maybe_unused]] auto num_steps = target.dynamics_world->stepSimulation(delta, 0, 0);
+	assert(num_steps == 1);
+}
+
+void cw::physics::step(const double &delta) {
+	step(default_world, delta);
 }
 
 glm::vec3 cw::physics::from(const btVector3 &in) {
@@ -56,9 +165,9 @@ glm::quat cw::physics::from(const btQuaternion &in) {
 
 btQuaternion cw::physics::to(const glm::quat &in) {
 	btQuaternion q;
-	q.setW(in.x);
-	q.setX(in.z);
-	q.setY(-in.y);
-	q.setZ(in.w);
+	q.setW(in.w);
+	q.setX(in.x);
+	q.setY(in.z);
+	q.setZ(-in.y);
 	return q;
 }
@@ -4,10 +4,26 @@
 #include <glm/gtc/quaternion.hpp>
 #include <btBulletDynamicsCommon.h>
 
+class btConstraintSolverPoolMt;
+
 namespace cw::physics {
+	// Everything one simulation needs. Worlds share nothing but the task scheduler, so several can
+	// step at the same time on different threads.
+	struct world {
+		btDefaultCollisionConfiguration *collision_configuration = 0;
+		btCollisionDispatcher *collision_dispatcher = 0;
+		btBroadphaseInterface *broadphase_interface = 0;
+		btConstraintSolver *constraint_solver = 0;
+		btConstraintSolverPoolMt *constraint_solver_pool = 0;
+		btDiscreteDynamicsWorld *dynamics_world = 0;
+	};
+	int configured_threads();
+	void create_world(world &target, int num_threads);
+	void destroy_world(world &target);
+	void step(world &target, const double &delta);
 	glm::vec3 from(const btVector3 &in);
 	btVector3 to(const glm::vec3 &in);
 	glm::quat from(const btQuaternion &in);
 	btQuaternion to(const glm::quat &in);
 	extern btDiscreteDynamicsWorld *dynamics_world;
-}
\ No newline at end of file
+}
@@ -12,3 +12,9 @@ float cw::pov::far_plane_distance = 200.01f;
 glm::mat4 cw::pov::view_matrix = glm::identity<glm::mat4>();
 glm::mat4 cw::pov::projection_matrix = glm::identity<glm::mat4>();
 const glm::vec3 cw::pov::up { 0, 0, 1 };
+
+float cw::pov::screen_extent(const glm::vec3 &center, float radius, float viewport_height) {
+	const float distance = glm::length(center - eye);
+	if (distance <= radius) return viewport_height;
+	return (radius / (distance * tanf(field_of_view * 0.5f))) * viewport_height;
+}
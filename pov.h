@@ -14,4 +14,5 @@ namespace cw::pov {
 	extern glm::mat4 view_matrix;
 	extern glm::mat4 projection_matrix;
 	extern const glm::vec3 up;
+	float screen_extent(const glm::vec3 &center, float radius, float viewport_height);
 }
@@ -0,0 +1,77 @@
+#include "prediction.h"
+
+#include <chrono>
+#include <algorithm>
+#include <glm/geometric.hpp>
+
+void cw::prediction::reset(history &target) {
+	target = history();
+}
+
+cw::replication::character_state cw::prediction::read(const characters::set &source, size_t character) {
+	return { source.location[character], source.velocity[character], source.grounded[character] != 0 };
+}
+
+void cw::prediction::write(characters::set &target, size_t character, const replication::character_state &state) {
+	target.location[character] = state.location;
+	target.velocity[character] = state.velocity;
+	target.grounded[character] = state.grounded;
+	target.object[character]->getWorldTransform().setOrigin(physics::to(state.location));
+	target.world->updateSingleAabb(target.object[character]);
+}
+
+void cw::prediction::record(history &target, const replication::input_command &command, const replication::character_state &after) {
+	target.inputs[command.tick % capacity] = command;
+	target.states[command.tick % capacity] = after;
+	target.newest = command.tick;
+}
+
+// The commands the server hasn't confirmed yet, newest first, for resending until it does.
+size_t cw::prediction::unacknowledged(const history &target, uint32_t acknowledged, replication::input_command *newest_first, size_t max_count) {
+	size_t count = 0;
+	for (uint32_t tick = target.newest; tick > acknowledged && count < max_count && target.newest - tick < capacity; tick--) {
+		const auto &command = target.inputs[tick % capacity];
+		if (command.tick != tick) break;
+		newest_first[count++] = command;
+	}
+	return count;
+}
+
+// Only the local character is put back and stepped again. Everything else the client shows comes
+// from snapshots anyway, and the rest of its world isn't rewound. `correction` is how far the
+// character's current location moved, for smoothing the jump out over the next few frames.
+bool cw::prediction::reconcile(history &target, uint32_t acknowledged, const replication::character_state &authoritative, characters::set &characters, size_t character, float delta, glm::vec3 &correction) {
+	correction = { 0, 0, 0 };
+	if (acknowledged <= target.reconciled) return false;
+	target.reconciled = acknowledged;
+	if (acknowledged > target.newest || target.newest - acknowledged >= capacity) return false;
+	if (target.inputs[acknowledged % capacity].tick != acknowledged) return false;
+	auto &predicted = target.states[acknowledged % capacity];
+	const bool matches = glm::length(predicted.location - authoritative.location) < location_tolerance
+		&& glm::length(predicted.velocity - authoritative.velocity) < velocity_tolerance
+		&& predicted.grounded == authoritative.grounded;
+	if (matches) return false;
+	const auto replay_start = std::chrono::steady_clock::now();
+	const auto before = characters.location[character];
+	// The command that was active when the replay started is put back afterwards, the coming step sets its own.
+	const auto movement = characters.movement_input[character];
+	const auto yaw = characters.yaw_input[character];
+	write(characters, character, authoritative);
+	predicted = authoritative;
+	for (uint32_t tick = acknowledged + 1; tick <= target.newest; tick++) {
+		const auto &command = target.inputs[tick % capacity];
+		characters.movement_input[character] = characters::movement_from_buttons(command.buttons);
+		characters.yaw_input[character] = command.yaw;
+		characters::step(characters, delta);
+		target.states[tick % capacity] = read(characters, character);
+	}
+	characters.movement_input[character] = movement;
+	characters.yaw_input[character] = yaw;
+	correction = before - characters.location[character];
+	target.num_corrections++;
+	target.last_replayed_ticks = target.newest - acknowledged;
+	target.last_replay_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - replay_start).count();
+	target.mean_replay_ms += (target.last_replay_ms - target.mean_replay_ms) * 0.1;
+	target.max_replay_ms = std::max(target.max_replay_ms, target.last_replay_ms);
+	return true;
+}
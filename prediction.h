@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <glm/vec3.hpp>
+
+#include "characters.h"
+#include "replication.h"
+
+// Client side prediction for the local character. Every fixed step the command and the state it led
+// to are kept in a ring until the server has applied that command. When the server's state for an
+// acknowledged command disagrees with what was predicted, the character is put where the server
+// says and only the commands after it are stepped again.
+
+namespace cw::prediction {
+	const size_t capacity = 128;
+	// Differences smaller than this are rounding, not mispredictions.
+	const float location_tolerance = 0.01f;
+	const float velocity_tolerance = 0.05f;
+	struct history {
+		replication::input_command inputs[capacity];
+		replication::character_state states[capacity];
+		uint32_t newest = 0;
+		uint32_t reconciled = 0;
+		uint64_t num_corrections = 0;
+		uint32_t last_replayed_ticks = 0;
+		double last_replay_ms = 0;
+		double mean_replay_ms = 0;
+		double max_replay_ms = 0;
+	};
+	void reset(history &target);
+	replication::character_state read(const characters::set &source, size_t character);
+	void write(characters::set &target, size_t character, const replication::character_state &state);
+	void record(history &target, const replication::input_command &command, const replication::character_state &after);
+	size_t unacknowledged(const history &target, uint32_t acknowledged, replication::input_command *newest_first, size_t max_count);
+	bool reconcile(history &target, uint32_t acknowledged, const replication::character_state &authoritative, characters::set &characters, size_t character, float delta, glm::vec3 &correction);
+}
@@ -0,0 +1,121 @@
+#include "projectiles.h"
+
+#include <iterator>
+#include <assert.h>
+#include <glm/glm.hpp>
+
+namespace cw::projectiles {
+	// Indexed by weapon::id.
+	const ballistics table[] = {
+		{ 0, 0, 0, 0, 0 },
+		{ 320, 0, 0.1f, 1, 1.5f },
+		{ 28, 0.08f, 1, 3, 12 }
+	};
+	void resolve(pool &target, const std::vector<size_t> &owners, const queries::results &results, float delta);
+}
+
+const cw::projectiles::ballistics &cw::projectiles::ballistics_for(weapon::id weapon) {
+	return table[static_cast<size_t>(weapon)];
+}
+
+void cw::projectiles::reserve(pool &target, size_t capacity) {
+	release(target);
+	target.capacity = capacity;
+	target.live = 0;
+	target.location.resize(capacity);
+	target.velocity.resize(capacity);
+	target.remaining_time.resize(capacity);
+	target.weapon.resize(capacity);
+	target.ignore.resize(capacity);
+	target.finished.resize(capacity);
+	target.impacts.reserve(capacity);
+	target.rays.reserve(capacity);
+	target.sweeps.reserve(capacity);
+	target.ray_results.reserve(capacity);
+	target.sweep_results.reserve(capacity);
+	target.ray_owners.reserve(capacity);
+	target.sweep_owners.reserve(capacity);
+	for (size_t i = 0; i < std::size(table); i++) if (table[i].radius > 0) target.sphere_shapes[i] = new btSphereShape(table[i].radius);
+}
+
+void cw::projectiles::release(pool &target) {
+	for (auto &shape : target.sphere_shapes) {
+		delete shape;
+		shape = 0;
+	}
+	target.live = 0;
+	target.impacts.clear();
+}
+
+// Returns false when the pool is full, the shot is dropped rather than growing the pool mid-game.
+bool cw::projectiles::spawn(pool &target, weapon::id weapon, const glm::vec3 &origin, const glm::vec3 &direction, const glm::vec3 &inherited_velocity, const btCollisionObject *ignore) {
+	assert(weapon != weapon::id::null);
+	if (target.live == target.capacity) return false;
+	const size_t i = target.live++;
+	auto &spec = ballistics_for(weapon);
+	target.location[i] = origin;
+	target.velocity[i] = glm::normalize(direction) * spec.speed + inherited_velocity;
+	target.remaining_time[i] = spec.lifetime;
+	target.weapon[i] = weapon;
+	target.ignore[i] = ignore;
+	target.finished[i] = false;
+	return true;
+}
+
+void cw::projectiles::resolve(pool &target, const std::vector<size_t> &owners, const queries::results &results, float delta) {
+	for (size_t j = 0; j < owners.size(); j++) {
+		const size_t i = owners[j];
+		if (results.hit[j]) {
+			target.impacts.push_back({ target.weapon[i], results.point[j], results.normal[j], target.velocity[i], results.object[j] });
+			target.location[i] = results.point[j];
+			target.finished[i] = true;
+			continue;
+		}
+		target.location[i] += target.velocity[i] * delta;
+		if (target.remaining_time[i] > 0) continue;
+		// A grenade that never touched anything still goes off where its fuse ran out.
+		if (target.weapon[i] == weapon::id::grenade_launcher) target.impacts.push_back({ target.weapon[i], target.location[i], { 0, 0, 1 }, target.velocity[i], 0 });
+		target.finished[i] = true;
+	}
+}
+
+void cw::projectiles::step(pool &target, btCollisionWorld *world, float delta) {
+	target.impacts.clear();
+	if (!target.live) return;
+	target.rays.clear();
+	target.sweeps.clear();
+	target.ray_owners.clear();
+	target.sweep_owners.clear();
+	for (size_t i = 0; i < target.live; i++) {
+		auto &spec = ballistics_for(target.weapon[i]);
+		target.velocity[i] += target.gravity * spec.gravity_scale * delta;
+		target.remaining_time[i] -= delta;
+		const auto to = target.location[i] + target.velocity[i] * delta;
+		if (auto shape = target.sphere_shapes[static_cast<size_t>(target.weapon[i])]) {
+			target.sweeps.add(shape, target.location[i], to, btBroadphaseProxy::DefaultFilter, btBroadphaseProxy::AllFilter, target.ignore[i]);
+			target.sweep_owners.push_back(i);
+		} else {
+			target.rays.add(target.location[i], to, btBroadphaseProxy::DefaultFilter, btBroadphaseProxy::AllFilter, target.ignore[i]);
+			target.ray_owners.push_back(i);
+		}
+	}
+	if (target.rays.size()) queries::cast_rays(world, target.rays, target.ray_results);
+	if (target.sweeps.size()) queries::cast_sweeps(world, target.sweeps, target.sweep_results);
+	resolve(target, target.ray_owners, target.ray_results, delta);
+	resolve(target, target.sweep_owners, target.sweep_results, delta);
+	// Compact in place, keeping firing order so older projectiles stay at the front.
+	size_t kept = 0;
+	for (size_t i = 0; i < target.live; i++) {
+		if (target.finished[i]) continue;
+		if (kept != i) {
+			target.location[kept] = target.location[i];
+			target.velocity[kept] = target.velocity[i];
+			target.remaining_time[kept] = target.remaining_time[i];
+			target.weapon[kept] = target.weapon[i];
+			target.ignore[kept] = target.ignore[i];
+			target.finished[kept] = false;
+		}
+		kept++;
+	}
+	target.live = kept;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/vec3.hpp>
+
+#include "physics.h"
+#include "queries.h"
+#include "weapon.h"
+
+// Bullets and grenades stored as parallel arrays in a pool sized up front. They are not rigid bodies:
+// every step moves them along their velocity and checks the path with one batched ray cast for the
+// point-sized ones and one batched sphere sweep for the rest. Whatever they hit during a step is
+// reported in `impacts` until the next step.
+
+namespace cw::projectiles {
+	struct ballistics {
+		float speed;
+		float radius;
+		float gravity_scale;
+		float lifetime;
+		float impulse;
+	};
+	struct impact {
+		weapon::id weapon;
+		glm::vec3 point;
+		glm::vec3 normal;
+		glm::vec3 velocity;
+		// Zero when the projectile ran out of time without hitting anything.
+		const btCollisionObject *object;
+	};
+	struct pool {
+		glm::vec3 gravity { 0, 0, -15 };
+		size_t capacity = 0;
+		size_t live = 0;
+		std::vector<glm::vec3> location;
+		std::vector<glm::vec3> velocity;
+		std::vector<float> remaining_time;
+		std::vector<weapon::id> weapon;
+		std::vector<const btCollisionObject *> ignore;
+		std::vector<uint8_t> finished;
+		std::vector<impact> impacts;
+		btSphereShape *sphere_shapes[3] = { 0, 0, 0 };
+		queries::ray_batch rays;
+		queries::sweep_batch sweeps;
+		queries::results ray_results;
+		queries::results sweep_results;
+		std::vector<size_t> ray_owners;
+		std::vector<size_t> sweep_owners;
+	};
+	const ballistics &ballistics_for(weapon::id weapon);
+	void reserve(pool &target, size_t capacity);
+	void release(pool &target);
+	bool spawn(pool &target, weapon::id weapon, const glm::vec3 &origin, const glm::vec3 &direction, const glm::vec3 &inherited_velocity = glm::vec3(0), const btCollisionObject *ignore = 0);
+	void step(pool &target, btCollisionWorld *world, float delta);
+}
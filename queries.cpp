@@ -0,0 +1,181 @@
+#include "queries.h"
+#include "physics.h"
+#include "jobs.h"
+
+#include <BulletCollision/BroadphaseCollision/btDbvtBroadphase.h>
+
+namespace cw::queries {
+	const size_t queries_per_chunk = 64;
+	struct ray_collector : btDbvt::ICollide {
+		btTransform from, to;
+		btCollisionWorld::RayResultCallback *callback = 0;
+		const btCollisionObject *ignore = 0;
+		void Process(const btDbvtNode *leaf) override;
+	};
+	struct sweep_collector : btDbvt::ICollide {
+		btTransform from, to;
+		const btConvexShape *shape = 0;
+		btCollisionWorld::ConvexResultCallback *callback = 0;
+		const btCollisionObject *ignore = 0;
+		void Process(const btDbvtNode *leaf) override;
+	};
+	void traverse(const btDbvtBroadphase *broadphase, const btVector3 &from, const btVector3 &to, const btVector3 &aabb_min, const btVector3 &aabb_max, btAlignedObjectArray<const btDbvtNode *> &stack, btDbvt::ICollide &policy);
+}
+
+void cw::queries::ray_batch::clear() {
+	from.clear();
+	to.clear();
+	group.clear();
+	mask.clear();
+	ignore.clear();
+}
+
+void cw::queries::ray_batch::reserve(size_t capacity) {
+	from.reserve(capacity);
+	to.reserve(capacity);
+	group.reserve(capacity);
+	mask.reserve(capacity);
+	ignore.reserve(capacity);
+}
+
+void cw::queries::ray_batch::add(const glm::vec3 &from, const glm::vec3 &to, int group, int mask, const btCollisionObject *ignore) {
+	this->from.push_back(from);
+	this->to.push_back(to);
+	this->group.push_back(group);
+	this->mask.push_back(mask);
+	this->ignore.push_back(ignore);
+}
+
+void cw::queries::sweep_batch::clear() {
+	shape.clear();
+	from.clear();
+	to.clear();
+	group.clear();
+	mask.clear();
+	ignore.clear();
+}
+
+void cw::queries::sweep_batch::reserve(size_t capacity) {
+	shape.reserve(capacity);
+	from.reserve(capacity);
+	to.reserve(capacity);
+	group.reserve(capacity);
+	mask.reserve(capacity);
+	ignore.reserve(capacity);
+}
+
+void cw::queries::sweep_batch::add(const btConvexShape *shape, const glm::vec3 &from, const glm::vec3 &to, int group, int mask, const btCollisionObject *ignore) {
+	this->shape.push_back(shape);
+	this->from.push_back(from);
+	this->to.push_back(to);
+	this->group.push_back(group);
+	this->mask.push_back(mask);
+	this->ignore.push_back(ignore);
+}
+
+void cw::queries::results::resize(size_t size) {
+	hit.resize(size);
+	fraction.resize(size);
+	point.resize(size);
+	normal.resize(size);
+	object.resize(size);
+}
+
+void cw::queries::results::reserve(size_t capacity) {
+	hit.reserve(capacity);
+	fraction.reserve(capacity);
+	point.reserve(capacity);
+	normal.reserve(capacity);
+	object.reserve(capacity);
+}
+
+void cw::queries::ray_collector::Process(const btDbvtNode *leaf) {
+	auto proxy = static_cast<btBroadphaseProxy *>(leaf->data);
+	auto object = static_cast<btCollisionObject *>(proxy->m_clientObject);
+	if (object == ignore || !callback->needsCollision(proxy)) return;
+	btCollisionWorld::rayTestSingle(from, to, object, object->getCollisionShape(), object->getWorldTransform(), *callback);
+}
+
+void cw::queries::sweep_collector::Process(const btDbvtNode *leaf) {
+	auto proxy = static_cast<btBroadphaseProxy *>(leaf->data);
+	auto object = static_cast<btCollisionObject *>(proxy->m_clientObject);
+	if (object == ignore || !callback->needsCollision(proxy)) return;
+	btCollisionWorld::objectQuerySingle(shape, from, to, object, object->getCollisionShape(), object->getWorldTransform(), *callback, 0);
+}
+
+// Same walk as btDbvtBroadphase::rayTest, but with a caller owned stack so any number of threads can
+// share the trees. The broadphase's own version reuses a single stack unless Bullet is BT_THREADSAFE.
+void cw::queries::traverse(const btDbvtBroadphase *broadphase, const btVector3 &from, const btVector3 &to, const btVector3 &aabb_min, const btVector3 &aabb_max, btAlignedObjectArray<const btDbvtNode *> &stack, btDbvt::ICollide &policy) {
+	auto direction = to - from;
+	if (direction.fuzzyZero()) direction = btVector3(0, 1, 0);
+	else direction.normalize();
+	btVector3 direction_inverse;
+	unsigned int signs[3];
+	for (int i = 0; i < 3; i++) {
+		direction_inverse[i] = direction[i] == btScalar(0) ? btScalar(BT_LARGE_FLOAT) : btScalar(1) / direction[i];
+		signs[i] = direction_inverse[i] < 0;
+	}
+	const btScalar lambda_max = direction.dot(to - from);
+	for (auto &set : broadphase->m_sets) set.rayTestInternal(set.m_root, from, to, direction_inverse, signs, lambda_max, aabb_min, aabb_max, stack, policy);
+}
+
+void cw::queries::cast_rays(btCollisionWorld *world, const ray_batch &batch, results &out) {
+	out.resize(batch.size());
+	// physics::initialize always builds a dbvt broadphase, worlds made elsewhere must do the same.
+	auto broadphase = static_cast<const btDbvtBroadphase *>(world->getBroadphase());
+	jobs::parallel_for(0, batch.size(), queries_per_chunk, [&](size_t begin, size_t end) {
+		btAlignedObjectArray<const btDbvtNode *> stack;
+		const btVector3 zero(0, 0, 0);
+		for (size_t i = begin; i < end; i++) {
+			auto from = physics::to(batch.from[i]), to = physics::to(batch.to[i]);
+			btCollisionWorld::ClosestRayResultCallback callback(from, to);
+			callback.m_collisionFilterGroup = batch.group[i];
+			callback.m_collisionFilterMask = batch.mask[i];
+			ray_collector collector;
+			collector.from.setIdentity();
+			collector.from.setOrigin(from);
+			collector.to.setIdentity();
+			collector.to.setOrigin(to);
+			collector.callback = &callback;
+			collector.ignore = batch.ignore[i];
+			traverse(broadphase, from, to, zero, zero, stack, collector);
+			out.hit[i] = callback.hasHit();
+			out.fraction[i] = callback.m_closestHitFraction;
+			out.point[i] = callback.hasHit() ? physics::from(callback.m_hitPointWorld) : batch.to[i];
+			out.normal[i] = callback.hasHit() ? physics::from(callback.m_hitNormalWorld) : glm::vec3(0);
+			out.object[i] = callback.m_collisionObject;
+		}
+	});
+}
+
+void cw::queries::cast_sweeps(btCollisionWorld *world, const sweep_batch &batch, results &out) {
+	out.resize(batch.size());
+	auto broadphase = static_cast<const btDbvtBroadphase *>(world->getBroadphase());
+	jobs::parallel_for(0, batch.size(), queries_per_chunk, [&](size_t begin, size_t end) {
+		btAlignedObjectArray<const btDbvtNode *> stack;
+		btTransform identity;
+		identity.setIdentity();
+		for (size_t i = begin; i < end; i++) {
+			auto from = physics::to(batch.from[i]), to = physics::to(batch.to[i]);
+			btCollisionWorld::ClosestConvexResultCallback callback(from, to);
+			callback.m_collisionFilterGroup = batch.group[i];
+			callback.m_collisionFilterMask = batch.mask[i];
+			sweep_collector collector;
+			collector.from.setIdentity();
+			collector.from.setOrigin(from);
+			collector.to.setIdentity();
+			collector.to.setOrigin(to);
+			collector.shape = batch.shape[i];
+			collector.callback = &callback;
+			collector.ignore = batch.ignore[i];
+			btVector3 aabb_min, aabb_max;
+			batch.shape[i]->getAabb(identity, aabb_min, aabb_max);
+			traverse(broadphase, from, to, aabb_min, aabb_max, stack, collector);
+			out.hit[i] = callback.hasHit();
+			out.fraction[i] = callback.m_closestHitFraction;
+			out.point[i] = callback.hasHit() ? physics::from(callback.m_hitPointWorld) : batch.to[i];
+			out.normal[i] = callback.hasHit() ? physics::from(callback.m_hitNormalWorld) : glm::vec3(0);
+			out.object[i] = callback.m_hitCollisionObject;
+		}
+	});
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/vec3.hpp>
+#include <btBulletDynamicsCommon.h>
+
+// Batched ray and shape casts. Every batch is answered in parallel on the job system against the
+// world's broadphase as it stands, so nothing may add, remove or move objects while a batch runs.
+// Locations are in engine space, like the rest of the gameplay code.
+
+namespace cw::queries {
+	struct ray_batch {
+		std::vector<glm::vec3> from;
+		std::vector<glm::vec3> to;
+		std::vector<int> group;
+		std::vector<int> mask;
+		std::vector<const btCollisionObject *> ignore;
+		size_t size() const { return from.size(); }
+		void clear();
+		void reserve(size_t capacity);
+		void add(const glm::vec3 &from, const glm::vec3 &to, int group = btBroadphaseProxy::DefaultFilter, int mask = btBroadphaseProxy::AllFilter, const btCollisionObject *ignore = 0);
+	};
+	struct sweep_batch {
+		std::vector<const btConvexShape *> shape;
+		std::vector<glm::vec3> from;
+		std::vector<glm::vec3> to;
+		std::vector<int> group;
+		std::vector<int> mask;
+		std::vector<const btCollisionObject *> ignore;
+		size_t size() const { return from.size(); }
+		void clear();
+		void reserve(size_t capacity);
+		void add(const btConvexShape *shape, const glm::vec3 &from, const glm::vec3 &to, int group = btBroadphaseProxy::DefaultFilter, int mask = btBroadphaseProxy::AllFilter, const btCollisionObject *ignore = 0);
+	};
+	struct results {
+		std::vector<uint8_t> hit;
+		std::vector<float> fraction;
+		std::vector<glm::vec3> point;
+		std::vector<glm::vec3> normal;
+		std::vector<const btCollisionObject *> object;
+		void resize(size_t size);
+		void reserve(size_t capacity);
+	};
+	void cast_rays(btCollisionWorld *world, const ray_batch &batch, results &out);
+	void cast_sweeps(btCollisionWorld *world, const sweep_batch &batch, results &out);
+}
@@ -0,0 +1,191 @@
+#include "replay.h"
+#include "misc.h"
+
+#include <iostream>
+#include <cstring>
+#include <chrono>
+#include <fmt/format.h>
+
+namespace cw::replay {
+	struct file_header {
+		char magic[4];
+		uint32_t version;
+		uint32_t simulation_rate;
+		uint32_t hash_interval;
+		uint32_t settings_size;
+	};
+	const char magic[4] = { 'C', 'W', 'R', 'P' };
+	const uint32_t version = 1;
+	std::filesystem::path recording_path;
+	// The whole recording stays in memory and is written out at the end, so recording never waits on the disk.
+	std::vector<char> buffer;
+	size_t cursor = 0;
+	std::vector<network_event> pending_network_events;
+	std::chrono::steady_clock::time_point playback_start;
+	template <typename T> void put(const T &value);
+	template <typename T> bool get(T &value);
+}
+
+cw::replay::mode cw::replay::current_mode = cw::replay::mode::off;
+uint32_t cw::replay::simulation_rate = 0;
+nlohmann::json cw::replay::settings;
+uint64_t cw::replay::num_ticks = 0;
+uint64_t cw::replay::num_verified = 0;
+uint64_t cw::replay::num_mismatches = 0;
+cw::replay::tick_input cw::replay::played_input;
+std::vector<cw::replay::network_event> cw::replay::played_network_events;
+
+template <typename T> void cw::replay::put(const T &value) {
+	const size_t offset = buffer.size();
+	buffer.resize(offset + sizeof(T));
+	memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+template <typename T> bool cw::replay::get(T &value) {
+	if (cursor + sizeof(T) > buffer.size()) return false;
+	memcpy(&value, buffer.data() + cursor, sizeof(T));
+	cursor += sizeof(T);
+	return true;
+}
+
+bool cw::replay::begin_recording(const std::filesystem::path &path, uint32_t simulation_rate, const nlohmann::json &settings) {
+	end();
+	replay::simulation_rate = simulation_rate;
+	replay::settings = settings;
+	recording_path = path;
+	buffer.clear();
+	num_ticks = num_verified = num_mismatches = 0;
+	current_mode = mode::recording;
+	std::cout << "Recording input to \"" << path.string() << "\"." << std::endl;
+	return true;
+}
+
+bool cw::replay::begin_playback(const std::filesystem::path &path) {
+	end();
+	auto content = misc::read_file(path);
+	if (!content) {
+		std::cout << "Unable to read replay \"" << path.string() << "\"." << std::endl;
+		return false;
+	}
+	buffer = std::move(*content);
+	cursor = 0;
+	file_header header;
+	if (!get(header) || memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version || header.hash_interval != hash_interval || !header.simulation_rate || cursor + header.settings_size > buffer.size()) {
+		std::cout << "\"" << path.string() << "\" is not a replay this build can play." << std::endl;
+		buffer.clear();
+		return false;
+	}
+	simulation_rate = header.simulation_rate;
+	settings = nlohmann::json::from_msgpack(buffer.begin() + cursor, buffer.begin() + cursor + header.settings_size);
+	cursor += header.settings_size;
+	num_ticks = num_verified = num_mismatches = 0;
+	current_mode = mode::playing;
+	playback_start = std::chrono::steady_clock::now();
+	std::cout << "Playing replay \"" << path.string() << "\" at " << simulation_rate << " Hz." << std::endl;
+	return true;
+}
+
+// Held until the next tick is recorded, that's the first step that could have seen the event.
+void cw::replay::record_network_event(const network_event &event) {
+	if (current_mode != mode::recording) return;
+	pending_network_events.push_back(event);
+}
+
+void cw::replay::record_tick(const tick_input &input) {
+	if (current_mode != mode::recording) return;
+	put(input.buttons);
+	put(input.equipped);
+	put(input.yaw);
+	put(input.aim_origin);
+	put(input.aim_direction);
+	put(static_cast<uint16_t>(pending_network_events.size()));
+	for (auto &event : pending_network_events) {
+		put(event.type);
+		put(event.peer);
+		put(event.channel);
+		put(static_cast<uint32_t>(event.payload.size()));
+		buffer.insert(buffer.end(), event.payload.begin(), event.payload.end());
+	}
+	pending_network_events.clear();
+	num_ticks++;
+}
+
+// False once the recording runs out, or if it was cut short partway through a tick.
+bool cw::replay::play_tick() {
+	if (current_mode != mode::playing) return false;
+	auto &input = played_input;
+	uint16_t num_events = 0;
+	if (!(get(input.buttons) && get(input.equipped) && get(input.yaw) && get(input.aim_origin) && get(input.aim_direction) && get(num_events))) {
+		cursor = buffer.size();
+		return false;
+	}
+	played_network_events.resize(num_events);
+	for (auto &event : played_network_events) {
+		uint32_t payload_size = 0;
+		if (!(get(event.type) && get(event.peer) && get(event.channel) && get(payload_size)) || cursor + payload_size > buffer.size()) {
+			cursor = buffer.size();
+			return false;
+		}
+		event.payload.assign(buffer.begin() + cursor, buffer.begin() + cursor + payload_size);
+		cursor += payload_size;
+	}
+	num_ticks++;
+	return true;
+}
+
+// Whether the tick just stepped is one that carries a state hash. Hashing the world isn't free, so
+// callers check this before working one out.
+bool cw::replay::hash_due() {
+	return current_mode != mode::off && num_ticks && num_ticks % hash_interval == 0;
+}
+
+void cw::replay::check_state(uint64_t hash) {
+	if (!hash_due()) return;
+	if (current_mode == mode::recording) {
+		put(hash);
+		return;
+	}
+	uint64_t recorded = 0;
+	if (!get(recorded)) return;
+	if (recorded == hash) {
+		num_verified++;
+		return;
+	}
+	// Only the first few are worth printing, after one divergence every later hash differs too.
+	if (num_mismatches++ < 4) std::cout << "Replay diverged on tick #" << num_ticks << fmt::format(": expected {:016x}, got {:016x}.", recorded, hash) << std::endl;
+}
+
+bool cw::replay::finished() {
+	return current_mode == mode::playing && cursor >= buffer.size();
+}
+
+void cw::replay::end() {
+	if (current_mode == mode::recording) {
+		// Settings go in last, they can still change while recording (the host's role, for one).
+		const auto packed_settings = nlohmann::json::to_msgpack(settings);
+		file_header header;
+		memcpy(header.magic, magic, sizeof(magic));
+		header.version = version;
+		header.simulation_rate = simulation_rate;
+		header.hash_interval = hash_interval;
+		header.settings_size = static_cast<uint32_t>(packed_settings.size());
+		std::vector<char> ticks = std::move(buffer);
+		buffer.clear();
+		put(header);
+		buffer.insert(buffer.end(), packed_settings.begin(), packed_settings.end());
+		buffer.insert(buffer.end(), ticks.begin(), ticks.end());
+		if (misc::write_file(recording_path, buffer)) std::cout << "Recorded " << num_ticks << " ticks to \"" << recording_path.string() << "\" (" << buffer.size() << " bytes)." << std::endl;
+		else std::cout << "Unable to write replay \"" << recording_path.string() << "\"." << std::endl;
+	} else if (current_mode == mode::playing) {
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - playback_start).count();
+		std::cout << "Played " << num_ticks << " ticks in " << fmt::format("{:.3f} s ({:.3f} ms per tick). ", seconds, num_ticks ? seconds * 1000.0 / num_ticks : 0.0);
+		std::cout << num_verified << " state hash" << (num_verified == 1 ? "" : "es") << " matched, " << num_mismatches << " didn't." << std::endl;
+	}
+	current_mode = mode::off;
+	buffer.clear();
+	buffer.shrink_to_fit();
+	cursor = 0;
+	pending_network_events.clear();
+	played_input = tick_input();
+	played_network_events.clear();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <filesystem>
+#include <json.hpp>
+
+// Records everything the fixed step reads from outside the simulation, once per tick, so a match
+// can be stepped again later with exactly the same workload. Every `hash_interval` ticks a hash of
+// the world state goes in as well, and playback compares against it to catch the replay drifting.
+//
+// The file is a small header, the settings the recording was made with as MessagePack, then one
+// record per tick: buttons, equipped weapon, yaw and aim, network events, and a hash when due.
+
+namespace cw::replay {
+	enum class mode {
+		off,
+		recording,
+		playing
+	};
+	struct tick_input {
+		// `local_player::binary_input` in the low four bits, fire in the fifth.
+		uint8_t buttons = 0;
+		uint8_t equipped = 0;
+		float yaw = 0;
+		float aim_origin[3] = { 0, 0, 0 };
+		float aim_direction[3] = { 0, 0, 0 };
+	};
+	struct network_event {
+		uint8_t type = 0;
+		uint16_t peer = 0;
+		uint8_t channel = 0;
+		std::vector<char> payload;
+	};
+	const uint32_t hash_interval = 60;
+	extern mode current_mode;
+	extern uint32_t simulation_rate;
+	// Read back from the file during playback. While recording it can still be added to, it's written
+	// out when the recording ends.
+	extern nlohmann::json settings;
+	extern uint64_t num_ticks;
+	extern uint64_t num_verified;
+	extern uint64_t num_mismatches;
+	// The tick being played back: its input, and the network events that arrived before it in the
+	// order they were received.
+	extern tick_input played_input;
+	extern std::vector<network_event> played_network_events;
+	bool begin_recording(const std::filesystem::path &path, uint32_t simulation_rate, const nlohmann::json &settings);
+	bool begin_playback(const std::filesystem::path &path);
+	void record_network_event(const network_event &event);
+	void record_tick(const tick_input &input);
+	bool play_tick();
+	bool hash_due();
+	void check_state(uint64_t hash);
+	bool finished();
+	void end();
+}
@@ -0,0 +1,482 @@
+#include "replication.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+namespace cw::replication {
+	// Largest value any of the three smallest components of a unit quaternion can take.
+	const float smallest_three_range = 0.70710678f;
+	// Scratch space for building snapshots, kept between calls so a warm server doesn't allocate.
+	struct encoder {
+		bit_writer writer;
+		std::vector<uint32_t> removed;
+		std::vector<size_t> changed;
+		std::vector<const quantized *> bases;
+	};
+	struct change {
+		uint32_t id;
+		bool is_new;
+		uint32_t mask;
+		int32_t position[3];
+		uint32_t orientation;
+	};
+	struct decoder {
+		frame output;
+		std::vector<uint32_t> removed;
+		std::vector<change> changes;
+	};
+	// Per thread, a server process builds the snapshots of several matches at once.
+	thread_local encoder snapshot_encoder;
+	decoder snapshot_decoder;
+	uint32_t orientation_width(const precision &settings);
+	void encode(encoder &target, const frame &current, const frame *baseline, const precision &settings);
+	bool decode(decoder &target, bit_reader &reader, const frame *baseline, const precision &settings);
+	void send(ENetPeer *peer, uint8_t channel, const bit_writer &writer, uint32_t flags);
+	void write_state(bit_writer &writer, const character_state &state);
+	character_state read_state(bit_reader &reader);
+}
+
+void cw::replication::bit_writer::write(uint32_t value, uint32_t bits) {
+	if (!bits) return;
+	const uint64_t mask = bits == 32 ? 0xffffffffull : (1ull << bits) - 1;
+	scratch |= (static_cast<uint64_t>(value) & mask) << scratch_bits;
+	scratch_bits += bits;
+	while (scratch_bits >= 8) {
+		bytes.push_back(static_cast<uint8_t>(scratch & 0xff));
+		scratch >>= 8;
+		scratch_bits -= 8;
+	}
+}
+
+// Seven bits at a time with a continuation bit, small numbers are by far the most common.
+void cw::replication::bit_writer::write_varint(uint32_t value) {
+	do {
+		const uint32_t chunk = value & 0x7f;
+		value >>= 7;
+		write(chunk | (value ? 0x80 : 0), 8);
+	} while (value);
+}
+
+// Zigzag, so small negative deltas stay as short as small positive ones.
+void cw::replication::bit_writer::write_signed(int32_t value) {
+	write_varint((static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31));
+}
+
+void cw::replication::bit_writer::write_float(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	write(bits, 32);
+}
+
+void cw::replication::bit_writer::flush() {
+	if (scratch_bits) bytes.push_back(static_cast<uint8_t>(scratch & 0xff));
+	scratch = 0;
+	scratch_bits = 0;
+}
+
+// Reading past the end gives zeros and sets `overflow`, callers check it once at the end.
+uint32_t cw::replication::bit_reader::read(uint32_t bits) {
+	if (bit + bits > size * 8) {
+		overflow = true;
+		bit = size * 8;
+		return 0;
+	}
+	uint32_t value = 0;
+	for (uint32_t i = 0; i < bits; i++, bit++) value |= static_cast<uint32_t>((data[bit >> 3] >> (bit & 7)) & 1) << i;
+	return value;
+}
+
+uint32_t cw::replication::bit_reader::read_varint() {
+	uint32_t value = 0;
+	for (uint32_t shift = 0; shift < 35; shift += 7) {
+		const uint32_t chunk = read(8);
+		value |= (chunk & 0x7f) << shift;
+		if (!(chunk & 0x80) || overflow) return value;
+	}
+	overflow = true;
+	return 0;
+}
+
+int32_t cw::replication::bit_reader::read_signed() {
+	const uint32_t value = read_varint();
+	return static_cast<int32_t>((value >> 1) ^ (~(value & 1) + 1));
+}
+
+float cw::replication::bit_reader::read_float() {
+	const uint32_t bits = read(32);
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+uint32_t cw::replication::orientation_width(const precision &settings) {
+	return 2 + settings.orientation_bits * 3;
+}
+
+// Positions become whole numbers of steps. Orientations keep the index of their largest component
+// and the other three, the largest is recovered from the unit length on the way back.
+cw::replication::quantized cw::replication::quantize(const entity &source, const precision &settings) {
+	quantized out;
+	out.id = source.id;
+	for (int axis = 0; axis < 3; axis++) out.position[axis] = static_cast<int32_t>(std::lround(source.location[axis] / settings.position_step));
+	const auto rotation = glm::normalize(source.orientation);
+	const float components[4] = { rotation.x, rotation.y, rotation.z, rotation.w };
+	uint32_t largest = 0;
+	for (uint32_t i = 1; i < 4; i++) if (std::abs(components[i]) > std::abs(components[largest])) largest = i;
+	const float sign = components[largest] < 0 ? -1.0f : 1.0f;
+	const uint32_t max_value = (1u << settings.orientation_bits) - 1;
+	out.orientation = largest;
+	for (uint32_t i = 0; i < 4; i++) {
+		if (i == largest) continue;
+		const float normalized = glm::clamp(components[i] * sign / smallest_three_range * 0.5f + 0.5f, 0.0f, 1.0f);
+		out.orientation = (out.orientation << settings.orientation_bits) | static_cast<uint32_t>(std::lround(normalized * max_value));
+	}
+	return out;
+}
+
+cw::replication::entity cw::replication::dequantize(const quantized &source, const precision &settings) {
+	entity out;
+	out.id = source.id;
+	for (int axis = 0; axis < 3; axis++) out.location[axis] = source.position[axis] * settings.position_step;
+	const uint32_t max_value = (1u << settings.orientation_bits) - 1;
+	const uint32_t largest = (source.orientation >> (settings.orientation_bits * 3)) & 3;
+	float components[4];
+	float sum = 0;
+	int shift = static_cast<int>(settings.orientation_bits) * 2;
+	for (uint32_t i = 0; i < 4; i++) {
+		if (i == largest) continue;
+		const uint32_t value = (source.orientation >> shift) & max_value;
+		components[i] = (static_cast<float>(value) / max_value * 2.0f - 1.0f) * smallest_three_range;
+		sum += components[i] * components[i];
+		shift -= settings.orientation_bits;
+	}
+	components[largest] = std::sqrt(std::max(0.0f, 1.0f - sum));
+	out.orientation = glm::normalize(glm::quat(components[3], components[0], components[1], components[2]));
+	return out;
+}
+
+// Removed ids first, then every entity that is new or differs from the baseline. Ids are written as
+// the gap from the previous one, they're sorted so gaps are small.
+void cw::replication::encode(encoder &target, const frame &current, const frame *baseline, const precision &settings) {
+	target.removed.clear();
+	target.changed.clear();
+	target.bases.clear();
+	size_t i = 0;
+	const size_t num_base = baseline ? baseline->entities.size() : 0;
+	for (size_t j = 0; j < current.entities.size(); j++) {
+		const auto &next = current.entities[j];
+		while (i < num_base && baseline->entities[i].id < next.id) target.removed.push_back(baseline->entities[i++].id);
+		const quantized *base = i < num_base && baseline->entities[i].id == next.id ? &baseline->entities[i++] : 0;
+		if (base && !memcmp(base->position, next.position, sizeof(next.position)) && base->orientation == next.orientation) continue;
+		target.changed.push_back(j);
+		target.bases.push_back(base);
+	}
+	while (i < num_base) target.removed.push_back(baseline->entities[i++].id);
+	auto &writer = target.writer;
+	writer.write_varint(static_cast<uint32_t>(target.removed.size()));
+	uint32_t previous = 0;
+	for (auto id : target.removed) {
+		writer.write_varint(id - previous);
+		previous = id;
+	}
+	writer.write_varint(static_cast<uint32_t>(target.changed.size()));
+	previous = 0;
+	for (size_t k = 0; k < target.changed.size(); k++) {
+		const auto &next = current.entities[target.changed[k]];
+		const auto base = target.bases[k];
+		writer.write_varint(next.id - previous);
+		previous = next.id;
+		writer.write(base ? 0 : 1, 1);
+		if (!base) {
+			for (int axis = 0; axis < 3; axis++) writer.write_signed(next.position[axis]);
+			writer.write(next.orientation, orientation_width(settings));
+			continue;
+		}
+		uint32_t mask = 0;
+		for (int axis = 0; axis < 3; axis++) if (next.position[axis] != base->position[axis]) mask |= 1 << axis;
+		if (next.orientation != base->orientation) mask |= 1 << 3;
+		writer.write(mask, 4);
+		for (int axis = 0; axis < 3; axis++) if (mask & (1 << axis)) writer.write_signed(next.position[axis] - base->position[axis]);
+		if (mask & (1 << 3)) writer.write(next.orientation, orientation_width(settings));
+	}
+}
+
+bool cw::replication::decode(decoder &target, bit_reader &reader, const frame *baseline, const precision &settings) {
+	// Counts can claim far more records than the packet could hold, don't trust them with the allocator.
+	const uint32_t num_removed = reader.read_varint();
+	if (reader.overflow || num_removed > reader.size * 8) return false;
+	target.removed.resize(num_removed);
+	uint32_t previous = 0;
+	for (auto &id : target.removed) id = previous += reader.read_varint();
+	const uint32_t num_changes = reader.read_varint();
+	if (reader.overflow || num_changes > reader.size * 8) return false;
+	target.changes.resize(num_changes);
+	previous = 0;
+	for (auto &next : target.changes) {
+		next.id = previous += reader.read_varint();
+		next.is_new = reader.read(1);
+		next.mask = next.is_new ? 0xf : reader.read(4);
+		for (int axis = 0; axis < 3; axis++) next.position[axis] = next.mask & (1 << axis) ? reader.read_signed() : 0;
+		next.orientation = next.mask & (1 << 3) ? reader.read(orientation_width(settings)) : 0;
+	}
+	if (reader.overflow) return false;
+	auto &out = target.output.entities;
+	out.clear();
+	const size_t num_base = baseline ? baseline->entities.size() : 0;
+	size_t i = 0, j = 0, r = 0;
+	while (i < num_base || j < target.changes.size()) {
+		const bool take_base = j == target.changes.size() || (i < num_base && baseline->entities[i].id < target.changes[j].id);
+		if (take_base) {
+			const auto &base = baseline->entities[i++];
+			while (r < target.removed.size() && target.removed[r] < base.id) r++;
+			if (r < target.removed.size() && target.removed[r] == base.id) continue;
+			out.push_back(base);
+			continue;
+		}
+		const auto &next = target.changes[j++];
+		quantized entity;
+		if (i < num_base && baseline->entities[i].id == next.id) {
+			const auto &base = baseline->entities[i++];
+			entity = base;
+			for (int axis = 0; axis < 3; axis++) if (next.mask & (1 << axis)) entity.position[axis] += next.position[axis];
+			if (next.mask & (1 << 3)) entity.orientation = next.orientation;
+		} else {
+			if (!next.is_new) return false;
+			entity.id = next.id;
+			memcpy(entity.position, next.position, sizeof(entity.position));
+			entity.orientation = next.orientation;
+		}
+		out.push_back(entity);
+	}
+	return true;
+}
+
+// Peers that aren't connected are skipped, that includes the stand-ins a replay plays back with.
+void cw::replication::send(ENetPeer *peer, uint8_t channel, const bit_writer &writer, uint32_t flags) {
+	if (peer->state != ENET_PEER_STATE_CONNECTED) return;
+	auto packet = enet_packet_create(writer.bytes.data(), writer.bytes.size(), flags);
+	if (packet && enet_peer_send(peer, channel, packet) != 0) enet_packet_destroy(packet);
+}
+
+void cw::replication::write_state(bit_writer &writer, const character_state &state) {
+	for (int axis = 0; axis < 3; axis++) writer.write_float(state.location[axis]);
+	for (int axis = 0; axis < 3; axis++) writer.write_float(state.velocity[axis]);
+	writer.write(state.grounded, 1);
+}
+
+cw::replication::character_state cw::replication::read_state(bit_reader &reader) {
+	character_state state;
+	for (int axis = 0; axis < 3; axis++) state.location[axis] = reader.read_float();
+	for (int axis = 0; axis < 3; axis++) state.velocity[axis] = reader.read_float();
+	state.grounded = reader.read(1);
+	return state;
+}
+
+// Tells the new client which entity is theirs, how snapshots are quantized and how fast to step.
+void cw::replication::add_peer(server &target, ENetPeer *peer, uint32_t entity) {
+	remove_peer(target, peer);
+	peer_state new_peer;
+	new_peer.peer = peer;
+	new_peer.entity = entity;
+	target.peers.push_back(std::move(new_peer));
+	bit_writer writer;
+	writer.write(static_cast<uint32_t>(message::welcome), 8);
+	writer.write(entity, 32);
+	writer.write_float(target.settings.position_step);
+	writer.write(target.settings.orientation_bits, 8);
+	writer.write(target.simulation_rate, 32);
+	writer.flush();
+	send(peer, reliable_channel, writer, ENET_PACKET_FLAG_RELIABLE);
+}
+
+void cw::replication::remove_peer(server &target, ENetPeer *peer) {
+	target.peers.erase(std::remove_if(target.peers.begin(), target.peers.end(), [peer](const peer_state &state) {
+		return state.peer == peer;
+	}), target.peers.end());
+}
+
+// Every entity is quantized once. Peers without a selection share one frame, filtered peers get a
+// frame of their own holding only their relevant entities, where those not due a refresh repeat
+// what the baseline already has and so cost nothing to send.
+void cw::replication::send_snapshots(server &target, uint32_t tick, const std::vector<entity> &entities) {
+	auto &all = target.quantized_entities;
+	all.resize(entities.size());
+	for (size_t i = 0; i < entities.size(); i++) all[i] = quantize(entities[i], target.settings);
+	auto by_id = [](const quantized &a, const quantized &b) {
+		return a.id < b.id;
+	};
+	const uint32_t sequence = ++target.sequence;
+	auto &current = target.current;
+	current.sequence = sequence;
+	current.tick = tick;
+	current.entities.clear();
+	if (std::any_of(target.peers.begin(), target.peers.end(), [](const peer_state &peer) { return !peer.filtered; })) {
+		current.entities = all;
+		std::sort(current.entities.begin(), current.entities.end(), by_id);
+	}
+	auto &encoder = snapshot_encoder;
+	for (auto &peer : target.peers) {
+		const auto &candidate = peer.sent[peer.acked_sequence % history_length];
+		const frame *baseline = peer.acked_sequence && candidate.sequence == peer.acked_sequence ? &candidate : 0;
+		auto &outgoing = peer.filtered ? target.filtered : current;
+		if (peer.filtered) {
+			outgoing.sequence = sequence;
+			outgoing.tick = tick;
+			outgoing.entities.clear();
+			for (size_t k = 0; k < peer.relevant.size(); k++) {
+				auto next = all[peer.relevant[k]];
+				if (!peer.refresh[k] && baseline) {
+					auto held = std::lower_bound(baseline->entities.begin(), baseline->entities.end(), next, by_id);
+					if (held != baseline->entities.end() && held->id == next.id) next = *held;
+				}
+				outgoing.entities.push_back(next);
+			}
+			std::sort(outgoing.entities.begin(), outgoing.entities.end(), by_id);
+		}
+		encoder.writer.bytes.clear();
+		encoder.writer.write(static_cast<uint32_t>(message::snapshot), 8);
+		encoder.writer.write(sequence, 32);
+		encoder.writer.write(tick, 32);
+		encoder.writer.write(baseline ? baseline->sequence : 0, 32);
+		encoder.writer.write(peer.last_input.tick, 32);
+		if (peer.last_input.tick) write_state(encoder.writer, peer.authoritative);
+		encode(encoder, outgoing, baseline, target.settings);
+		encoder.writer.flush();
+		// Flag 0 makes it unreliable and sequenced, ENet drops anything older than what already arrived.
+		send(peer.peer, snapshot_channel, encoder.writer, 0);
+		peer.sent[sequence % history_length] = outgoing;
+		peer.bytes_sent += encoder.writer.bytes.size();
+		target.bytes_sent += encoder.writer.bytes.size();
+	}
+}
+
+// Acknowledgements only ever move the baseline forward, and only to a snapshot still on hand.
+// Commands are filed by tick, repeats of ones already filed or already used are ignored.
+void cw::replication::receive(server &target, ENetPeer *peer, const uint8_t *data, size_t size) {
+	bit_reader reader { data, size };
+	const auto type = static_cast<message>(reader.read(8));
+	auto state = std::find_if(target.peers.begin(), target.peers.end(), [peer](const peer_state &candidate) {
+		return candidate.peer == peer;
+	});
+	if (state == target.peers.end()) return;
+	if (type == message::ack) {
+		const uint32_t sequence = reader.read(32);
+		if (reader.overflow) return;
+		if (sequence > state->acked_sequence && state->sent[sequence % history_length].sequence == sequence) state->acked_sequence = sequence;
+	} else if (type == message::input) {
+		const uint32_t count = std::min<uint32_t>(reader.read(8), max_inputs_per_packet);
+		const uint32_t newest = reader.read(32);
+		for (uint32_t i = 0; i < count && i < newest; i++) {
+			input_command command;
+			command.tick = newest - i;
+			command.buttons = static_cast<uint8_t>(reader.read(4));
+			command.yaw = reader.read_float();
+			if (reader.overflow) return;
+			if (command.tick <= state->last_input.tick) break;
+			state->inputs[command.tick % input_buffer_length] = command;
+			state->newest_input_tick = std::max(state->newest_input_tick, command.tick);
+		}
+	}
+}
+
+// One command per simulation step. The first waits `input_delay` commands to build a cushion against
+// jitter. A command that never arrived repeats the one before it, and a client that ran far ahead is
+// caught up with. False until the peer has sent anything.
+bool cw::replication::next_input(peer_state &peer, input_command &out) {
+	if (!peer.newest_input_tick) return false;
+	const bool far_behind = peer.newest_input_tick > peer.last_input.tick + input_buffer_length / 2;
+	if ((!peer.last_input.tick || far_behind) && peer.newest_input_tick > input_delay) peer.last_input.tick = peer.newest_input_tick - input_delay;
+	if (peer.last_input.tick < peer.newest_input_tick) {
+		const uint32_t tick = peer.last_input.tick + 1;
+		const auto &slot = peer.inputs[tick % input_buffer_length];
+		if (slot.tick == tick) peer.last_input = slot;
+		else peer.last_input.tick = tick;
+	}
+	out = peer.last_input;
+	return true;
+}
+
+void cw::replication::reset(client &target) {
+	target.entity = 0;
+	target.simulation_rate = 0;
+	target.acknowledged_input = 0;
+	target.authoritative = character_state();
+	for (auto &slot : target.received) {
+		slot.sequence = 0;
+		slot.tick = 0;
+		slot.entities.clear();
+	}
+	target.latest = frame();
+}
+
+void cw::replication::receive(client &target, ENetPeer *peer, const uint8_t *data, size_t size) {
+	target.bytes_received += size;
+	bit_reader reader { data, size };
+	const auto type = static_cast<message>(reader.read(8));
+	if (type == message::welcome) {
+		reset(target);
+		target.entity = reader.read(32);
+		target.settings.position_step = reader.read_float();
+		target.settings.orientation_bits = std::min<uint32_t>(reader.read(8), 10);
+		target.simulation_rate = reader.read(32);
+		if (reader.overflow || !(target.settings.position_step > 0) || !target.settings.orientation_bits) {
+			std::cout << "Server sent an unusable welcome message." << std::endl;
+			target.entity = 0;
+		}
+		return;
+	}
+	if (type != message::snapshot || !target.entity) return;
+	const uint32_t sequence = reader.read(32);
+	const uint32_t tick = reader.read(32);
+	const uint32_t baseline_sequence = reader.read(32);
+	const uint32_t input_tick = reader.read(32);
+	const auto authoritative = input_tick ? read_state(reader) : character_state();
+	if (reader.overflow || sequence <= target.latest.sequence) return;
+	if (input_tick > target.acknowledged_input) {
+		target.acknowledged_input = input_tick;
+		target.authoritative = authoritative;
+	}
+	const frame *baseline = 0;
+	if (baseline_sequence) {
+		baseline = &target.received[baseline_sequence % history_length];
+		if (baseline->sequence != baseline_sequence) {
+			target.num_undecodable++;
+			return;
+		}
+	}
+	auto &decoder = snapshot_decoder;
+	if (!decode(decoder, reader, baseline, target.settings)) {
+		target.num_undecodable++;
+		return;
+	}
+	// Decoded into scratch first, the baseline may sit in the very slot this snapshot goes to.
+	auto &slot = target.received[sequence % history_length];
+	slot.sequence = sequence;
+	slot.tick = tick;
+	slot.entities.swap(decoder.output.entities);
+	target.latest = slot;
+	target.num_snapshots++;
+	bit_writer writer;
+	writer.write(static_cast<uint32_t>(message::ack), 8);
+	writer.write(sequence, 32);
+	writer.flush();
+	send(peer, snapshot_channel, writer, 0);
+}
+
+// Newest first, the ticks are consecutive so only the first one is written.
+void cw::replication::send_inputs(ENetPeer *peer, const input_command *newest_first, size_t count) {
+	count = std::min(count, max_inputs_per_packet);
+	if (!count) return;
+	bit_writer writer;
+	writer.write(static_cast<uint32_t>(message::input), 8);
+	writer.write(static_cast<uint32_t>(count), 8);
+	writer.write(newest_first[0].tick, 32);
+	for (size_t i = 0; i < count; i++) {
+		writer.write(newest_first[i].buttons, 4);
+		writer.write_float(newest_first[i].yaw);
+	}
+	writer.flush();
+	send(peer, snapshot_channel, writer, 0);
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+#include <glm/vec3.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <enet/enet.h>
+
+// Server to client entity state. Every snapshot is quantized, then encoded against the last one the
+// client acknowledged: entities that didn't change aren't sent at all, changed ones only send the
+// components that moved, as small deltas. Snapshots go out as unreliable sequenced packets on their
+// own channel, a lost one is simply replaced by the next. The precision is decided by the server and
+// handed to the client in a reliable welcome message when it connects.
+
+namespace cw::replication {
+	enum class message : uint8_t {
+		welcome,
+		snapshot,
+		ack,
+		input
+	};
+	// Channel 0 stays reliable, snapshots and acknowledgements use channel 1.
+	const uint8_t reliable_channel = 0;
+	const uint8_t snapshot_channel = 1;
+	// Snapshots kept on both ends for use as baselines, about a second at the default snapshot rate.
+	// Counted in snapshots rather than ticks, the two rates are configured separately.
+	const size_t history_length = 32;
+	// Commands the server holds per peer. Every input packet repeats the newest few, so a lost
+	// packet rarely loses a command.
+	const size_t input_buffer_length = 64;
+	const size_t max_inputs_per_packet = 8;
+	// Commands kept waiting before the first one is used, to ride out jitter.
+	const uint32_t input_delay = 2;
+	struct precision {
+		// Metres per quantization step.
+		float position_step = 1.0f / 256;
+		// Bits for each of the three smallest quaternion components, up to 10.
+		uint32_t orientation_bits = 10;
+	};
+	struct entity {
+		uint32_t id;
+		glm::vec3 location;
+		glm::quat orientation;
+	};
+	struct quantized {
+		uint32_t id;
+		int32_t position[3];
+		uint32_t orientation;
+	};
+	// Sorted by id, that is what lets two frames be compared in one pass. `sequence` counts the
+	// server's snapshots from 1 and is what baselines and acknowledgements refer to, `tick` is the
+	// simulation step it was taken after.
+	struct frame {
+		uint32_t sequence = 0;
+		uint32_t tick = 0;
+		std::vector<quantized> entities;
+	};
+	// One fixed step of a player's input, numbered by the client's own tick count.
+	struct input_command {
+		uint32_t tick = 0;
+		// Forward, left, back and right in the low four bits, as in `local_player::binary_input`.
+		uint8_t buttons = 0;
+		float yaw = 0;
+	};
+	// A character's complete movement state, sent at full precision so a client can tell a real
+	// misprediction from rounding.
+	struct character_state {
+		glm::vec3 location { 0, 0, 0 };
+		glm::vec3 velocity { 0, 0, 0 };
+		bool grounded = false;
+	};
+	struct bit_writer {
+		std::vector<uint8_t> bytes;
+		uint64_t scratch = 0;
+		uint32_t scratch_bits = 0;
+		void write(uint32_t value, uint32_t bits);
+		void write_varint(uint32_t value);
+		void write_signed(int32_t value);
+		void write_float(float value);
+		void flush();
+	};
+	struct bit_reader {
+		const uint8_t *data = 0;
+		size_t size = 0;
+		size_t bit = 0;
+		bool overflow = false;
+		uint32_t read(uint32_t bits);
+		uint32_t read_varint();
+		int32_t read_signed();
+		float read_float();
+	};
+	struct peer_state {
+		ENetPeer *peer = 0;
+		uint32_t entity = 0;
+		uint32_t acked_sequence = 0;
+		frame sent[history_length];
+		uint64_t bytes_sent = 0;
+		input_command inputs[input_buffer_length];
+		uint32_t newest_input_tick = 0;
+		// The command the character is moving by, and the tick it belongs to.
+		input_command last_input;
+		// The peer's own character after `last_input`, included in every snapshot to this peer.
+		character_state authoritative;
+		// Filled in by interest management before each snapshot: indices into the entities being
+		// sent, and whether each is refreshed or repeated from the baseline. Peers that aren't
+		// `filtered` get everything.
+		bool filtered = false;
+		std::vector<size_t> relevant;
+		std::vector<uint8_t> refresh;
+		// Interest management's memory of each relevant entity's tier.
+		std::unordered_map<uint32_t, uint8_t> tiers;
+	};
+	struct server {
+		precision settings;
+		uint32_t simulation_rate = 60;
+		std::vector<peer_state> peers;
+		// Sequence of the last snapshot sent.
+		uint32_t sequence = 0;
+		std::vector<quantized> quantized_entities;
+		frame current;
+		frame filtered;
+		uint64_t bytes_sent = 0;
+	};
+	struct client {
+		precision settings;
+		// The entity this client controls, 0 until the welcome arrives.
+		uint32_t entity = 0;
+		uint32_t simulation_rate = 0;
+		// Newest of our commands the server has applied, and where it left our character.
+		uint32_t acknowledged_input = 0;
+		character_state authoritative;
+		frame received[history_length];
+		frame latest;
+		uint64_t bytes_received = 0;
+		uint64_t num_snapshots = 0;
+		// Snapshots that named a baseline this client no longer had.
+		uint64_t num_undecodable = 0;
+	};
+	quantized quantize(const entity &source, const precision &settings);
+	entity dequantize(const quantized &source, const precision &settings);
+	void add_peer(server &target, ENetPeer *peer, uint32_t entity);
+	void remove_peer(server &target, ENetPeer *peer);
+	void send_snapshots(server &target, uint32_t tick, const std::vector<entity> &entities);
+	void receive(server &target, ENetPeer *peer, const uint8_t *data, size_t size);
+	bool next_input(peer_state &peer, input_command &out);
+	void reset(client &target);
+	void send_inputs(ENetPeer *peer, const input_command *newest_first, size_t count);
+	void receive(client &target, ENetPeer *peer, const uint8_t *data, size_t size);
+}
@@ -0,0 +1,157 @@
+#include "rollback.h"
+#include "misc.h"
+
+#include <cstring>
+#include <assert.h>
+
+namespace cw::rollback {
+	struct snapshot_header {
+		uint64_t tick;
+		uint32_t num_bodies;
+		uint32_t num_characters;
+	};
+	struct body_record {
+		btScalar origin[3];
+		btScalar rotation[4];
+		btScalar linear_velocity[3];
+		btScalar angular_velocity[3];
+		btScalar deactivation_time;
+		int32_t activation_state;
+	};
+	struct character_record {
+		float location[3];
+		float velocity[3];
+		uint32_t grounded;
+	};
+	bool is_snapshotted(const btCollisionObject *object);
+	size_t slot_for(const history &target, uint64_t tick);
+}
+
+// Static and kinematic objects never change during a step, so only bodies the solver moves are kept.
+bool cw::rollback::is_snapshotted(const btCollisionObject *object) {
+	auto body = btRigidBody::upcast(object);
+	return body && !body->isStaticOrKinematicObject();
+}
+
+size_t cw::rollback::slot_for(const history &target, uint64_t tick) {
+	return static_cast<size_t>(tick % target.slots.size());
+}
+
+void cw::rollback::reserve(history &target, size_t num_ticks) {
+	assert(num_ticks);
+	target.slots.assign(num_ticks, {});
+	target.ticks.assign(num_ticks, 0);
+	target.occupied.assign(num_ticks, false);
+}
+
+void cw::rollback::capture(history &target, uint64_t tick, btDynamicsWorld *world, const characters::set &characters) {
+	assert(!target.slots.empty());
+	const size_t slot = slot_for(target, tick);
+	auto &buffer = target.slots[slot];
+	auto &objects = world->getCollisionObjectArray();
+	uint32_t num_bodies = 0;
+	for (int i = 0; i < objects.size(); i++) num_bodies += is_snapshotted(objects[i]);
+	snapshot_header header { tick, num_bodies, static_cast<uint32_t>(characters.size()) };
+	// resize() keeps the slot's capacity, so a warm ring captures without touching the allocator.
+	buffer.resize(sizeof(snapshot_header) + num_bodies * sizeof(body_record) + header.num_characters * sizeof(character_record));
+	memcpy(buffer.data(), &header, sizeof(header));
+	auto bodies = reinterpret_cast<body_record *>(buffer.data() + sizeof(snapshot_header));
+	for (int i = 0; i < objects.size(); i++) {
+		if (!is_snapshotted(objects[i])) continue;
+		auto body = btRigidBody::upcast(objects[i]);
+		auto &transform = body->getWorldTransform();
+		auto rotation = transform.getRotation();
+		auto &record = *bodies++;
+		for (int axis = 0; axis < 3; axis++) {
+			record.origin[axis] = transform.getOrigin()[axis];
+			record.linear_velocity[axis] = body->getLinearVelocity()[axis];
+			record.angular_velocity[axis] = body->getAngularVelocity()[axis];
+		}
+		record.rotation[0] = rotation.x();
+		record.rotation[1] = rotation.y();
+		record.rotation[2] = rotation.z();
+		record.rotation[3] = rotation.w();
+		record.deactivation_time = body->getDeactivationTime();
+		record.activation_state = body->getActivationState();
+	}
+	auto character_records = reinterpret_cast<character_record *>(bodies);
+	for (size_t i = 0; i < characters.size(); i++) {
+		auto &record = character_records[i];
+		memcpy(record.location, &characters.location[i].x, sizeof(record.location));
+		memcpy(record.velocity, &characters.velocity[i].x, sizeof(record.velocity));
+		record.grounded = characters.grounded[i];
+	}
+	target.ticks[slot] = tick;
+	target.occupied[slot] = true;
+}
+
+bool cw::rollback::contains(const history &target, uint64_t tick) {
+	if (target.slots.empty()) return false;
+	const size_t slot = slot_for(target, tick);
+	return target.occupied[slot] && target.ticks[slot] == tick;
+}
+
+// The records have no padding, so equal world states always hash the same.
+uint64_t cw::rollback::hash(const history &target, uint64_t tick) {
+	if (!contains(target, tick)) return 0;
+	auto &buffer = target.slots[slot_for(target, tick)];
+	return misc::fnv1a(buffer.data(), buffer.size());
+}
+
+bool cw::rollback::restore(const history &target, uint64_t tick, btDynamicsWorld *world, characters::set &characters) {
+	if (!contains(target, tick)) return false;
+	auto &buffer = target.slots[slot_for(target, tick)];
+	snapshot_header header;
+	memcpy(&header, buffer.data(), sizeof(header));
+	auto &objects = world->getCollisionObjectArray();
+	uint32_t num_bodies = 0;
+	for (int i = 0; i < objects.size(); i++) num_bodies += is_snapshotted(objects[i]);
+	// Bodies are matched up by their order in the world, which only holds while nothing was added or removed.
+	if (num_bodies != header.num_bodies || header.num_characters != characters.size()) return false;
+	auto bodies = reinterpret_cast<const body_record *>(buffer.data() + sizeof(snapshot_header));
+	for (int i = 0; i < objects.size(); i++) {
+		if (!is_snapshotted(objects[i])) continue;
+		auto body = btRigidBody::upcast(objects[i]);
+		auto &record = *bodies++;
+		btTransform transform(
+			btQuaternion(record.rotation[0], record.rotation[1], record.rotation[2], record.rotation[3]),
+			btVector3(record.origin[0], record.origin[1], record.origin[2]));
+		btVector3 linear_velocity(record.linear_velocity[0], record.linear_velocity[1], record.linear_velocity[2]);
+		btVector3 angular_velocity(record.angular_velocity[0], record.angular_velocity[1], record.angular_velocity[2]);
+		body->setWorldTransform(transform);
+		body->setInterpolationWorldTransform(transform);
+		if (body->getMotionState()) body->getMotionState()->setWorldTransform(transform);
+		body->setLinearVelocity(linear_velocity);
+		body->setAngularVelocity(angular_velocity);
+		body->setInterpolationLinearVelocity(linear_velocity);
+		body->setInterpolationAngularVelocity(angular_velocity);
+		body->clearForces();
+		body->forceActivationState(record.activation_state);
+		body->setDeactivationTime(record.deactivation_time);
+	}
+	auto character_records = reinterpret_cast<const character_record *>(bodies);
+	for (size_t i = 0; i < characters.size(); i++) {
+		auto &record = character_records[i];
+		memcpy(&characters.location[i].x, record.location, sizeof(record.location));
+		memcpy(&characters.velocity[i].x, record.velocity, sizeof(record.velocity));
+		characters.grounded[i] = record.grounded;
+		characters.object[i]->getWorldTransform().setOrigin(physics::to(characters.location[i]));
+	}
+	// Cached contacts describe the future we just threw away, warm starting from them would make
+	// the resimulated steps drift from the originals.
+	auto dispatcher = world->getDispatcher();
+	for (int i = 0; i < dispatcher->getNumManifolds(); i++) dispatcher->getManifoldByIndexInternal(i)->clearManifold();
+	world->updateAabbs();
+	return true;
+}
+
+// Rewinds to `from_tick`, then steps forward to `to_tick` again, recapturing every tick on the way
+// so later rollbacks see the corrected history.
+bool cw::rollback::resimulate(history &target, uint64_t from_tick, uint64_t to_tick, btDynamicsWorld *world, characters::set &characters, const std::function<void(uint64_t tick)> &step) {
+	if (!restore(target, from_tick, world, characters)) return false;
+	for (uint64_t tick = from_tick + 1; tick <= to_tick; tick++) {
+		step(tick);
+		capture(target, tick, world, characters);
+	}
+	return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+#include "physics.h"
+#include "characters.h"
+
+// Whole-world snapshots for rewinding the simulation. Each snapshot is one contiguous buffer holding
+// every dynamic rigid body's motion state followed by every character's state, and snapshots are kept
+// in a fixed ring of per-tick slots so capturing never allocates once the ring is warm.
+
+namespace cw::rollback {
+	struct history {
+		std::vector<std::vector<char>> slots;
+		std::vector<uint64_t> ticks;
+		std::vector<uint8_t> occupied;
+	};
+	void reserve(history &target, size_t num_ticks);
+	void capture(history &target, uint64_t tick, btDynamicsWorld *world, const characters::set &characters);
+	bool contains(const history &target, uint64_t tick);
+	uint64_t hash(const history &target, uint64_t tick);
+	bool restore(const history &target, uint64_t tick, btDynamicsWorld *world, characters::set &characters);
+	bool resimulate(history &target, uint64_t from_tick, uint64_t to_tick, btDynamicsWorld *world, characters::set &characters, const std::function<void(uint64_t tick)> &step);
+}
@@ -0,0 +1,131 @@
+#include "scheduler.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+
+namespace cw::scheduler {
+	clock::time_point boundary(const schedule &target, const subsystem &system, uint64_t index);
+	uint64_t current_index(const schedule &target, const subsystem &system, clock::time_point now);
+}
+
+// Worked out from the origin every time instead of adding up periods, so rates that don't divide a
+// second evenly don't drift.
+cw::scheduler::clock::time_point cw::scheduler::boundary(const schedule &target, const subsystem &system, uint64_t index) {
+	return target.origin + std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds(index * 1000000000ull / system.rate));
+}
+
+// Index of the step whose slice contains `now`, every step before it is due.
+uint64_t cw::scheduler::current_index(const schedule &target, const subsystem &system, clock::time_point now) {
+	if (now <= target.origin) return 0;
+	const uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - target.origin).count();
+	return elapsed * system.rate / 1000000000ull;
+}
+
+size_t cw::scheduler::add(schedule &target, const std::string &name, uint32_t rate, int order, overrun policy, size_t max_steps_per_advance, const std::function<void(const step_info &)> &step) {
+	assert(rate > 0);
+	subsystem new_subsystem;
+	new_subsystem.name = name;
+	new_subsystem.rate = rate;
+	new_subsystem.order = order;
+	new_subsystem.policy = policy;
+	new_subsystem.max_steps_per_advance = std::max<size_t>(1, max_steps_per_advance);
+	new_subsystem.step = step;
+	if (target.started) new_subsystem.next_index = current_index(target, new_subsystem, clock::now());
+	target.subsystems.push_back(new_subsystem);
+	std::cout << "Scheduled \"" << name << "\" at " << rate << " Hz." << std::endl;
+	return target.subsystems.size() - 1;
+}
+
+void cw::scheduler::start(schedule &target, clock::time_point now) {
+	target.origin = now;
+	target.started = true;
+	target.saturated = false;
+	for (auto &system : target.subsystems) system.next_index = 0;
+}
+
+// Carries on from where the subsystem's time had got to, only the slices from here on change length.
+// Safe to call from inside a step.
+void cw::scheduler::set_rate(schedule &target, size_t index, uint32_t rate) {
+	assert(rate > 0);
+	auto &system = target.subsystems[index];
+	if (system.rate == rate) return;
+	const auto resume = boundary(target, system, system.next_index);
+	system.rate = rate;
+	if (target.started) system.next_index = current_index(target, system, resume);
+	std::cout << "Rescheduled \"" << system.name << "\" at " << rate << " Hz." << std::endl;
+}
+
+void cw::scheduler::advance(schedule &target, clock::time_point now) {
+	if (!target.started) {
+		start(target, now);
+		return;
+	}
+	for (auto &system : target.subsystems) system.steps_last_advance = 0;
+	target.saturated = false;
+	const auto advance_start = clock::now();
+	while (true) {
+		subsystem *next = 0;
+		clock::time_point next_end;
+		for (auto &system : target.subsystems) {
+			if (system.steps_last_advance >= system.max_steps_per_advance) continue;
+			const auto end = step_end(target, system, system.next_index);
+			if (end > now) continue;
+			if (!next || end < next_end || (end == next_end && system.order < next->order)) {
+				next = &system;
+				next_end = end;
+			}
+		}
+		if (!next) break;
+		if (clock::now() - advance_start > target.budget) {
+			target.saturated = true;
+			target.num_saturated++;
+			break;
+		}
+		const auto step_start = clock::now();
+		next->step({ 1.0 / next->rate, next->next_index, next_end });
+		next->last_ms = std::chrono::duration<double, std::milli>(clock::now() - step_start).count();
+		next->mean_ms += (next->last_ms - next->mean_ms) * 0.05;
+		next->max_ms = std::max(next->max_ms, next->last_ms);
+		next->next_index++;
+		next->num_steps++;
+		next->steps_last_advance++;
+	}
+	for (auto &system : target.subsystems) {
+		const uint64_t present = current_index(target, system, now);
+		if (system.next_index >= present) continue;
+		uint64_t keep = 0;
+		if (system.policy == overrun::defer) keep = system.rate;
+		if (present - system.next_index <= keep) continue;
+		const uint64_t num_skipped = present - system.next_index - keep;
+		system.next_index += num_skipped;
+		system.num_skipped += num_skipped;
+		// A single dropped step is routine for a subsystem that only runs once per advance.
+		if (num_skipped > 1) std::cout << "Subsystem \"" << system.name << "\" fell behind, skipped " << num_skipped << " steps at step #" << system.next_index << "." << std::endl;
+	}
+}
+
+cw::scheduler::clock::time_point cw::scheduler::step_end(const schedule &target, const subsystem &system, uint64_t index) {
+	return boundary(target, system, index + 1);
+}
+
+// Earliest time any subsystem has a step due, for sleeping until there's work.
+cw::scheduler::clock::time_point cw::scheduler::next_due(const schedule &target) {
+	auto earliest = clock::time_point::max();
+	for (auto &system : target.subsystems) earliest = std::min(earliest, step_end(target, system, system.next_index));
+	return earliest;
+}
+
+// How far `now` is between the last step that ran and the next, for blending their results.
+double cw::scheduler::interpolation(const schedule &target, size_t index, clock::time_point now) {
+	const auto &system = target.subsystems[index];
+	const auto last = boundary(target, system, system.next_index);
+	const auto next = boundary(target, system, system.next_index + 1);
+	if (now <= last) return 0;
+	if (now >= next) return 1;
+	return std::chrono::duration<double>(now - last).count() / std::chrono::duration<double>(next - last).count();
+}
+
+void cw::scheduler::reset_max(schedule &target) {
+	for (auto &system : target.subsystems) system.max_ms = 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Fixed steps for several subsystems, each at its own rate. Step `k` of a subsystem covers
+// [origin + k / rate, origin + (k + 1) / rate) and becomes due once the clock passes its end. Due
+// steps run in order of that end time, ties going to the lower `order`, so the interleaving only
+// depends on the rates and never on how the frames happened to fall.
+//
+// Catching up is bounded twice: per subsystem by `max_steps_per_advance` and for the whole
+// schedule by `budget`. Steps that are still due afterwards are handled by the subsystem's policy.
+
+namespace cw::scheduler {
+	using clock = std::chrono::steady_clock;
+	enum class overrun {
+		// Missed steps are dropped and the subsystem carries on from the present. Simulated time
+		// falls behind real time, but a slow stretch can never snowball.
+		skip,
+		// Missed steps stay due and are worked off over the next advances. Nothing is lost unless
+		// the backlog grows past a second, then the oldest of it is skipped anyway.
+		defer
+	};
+	struct step_info {
+		double delta;
+		uint64_t index;
+		// End of the step's time slice.
+		clock::time_point end;
+	};
+	struct subsystem {
+		std::string name;
+		uint32_t rate = 60;
+		int order = 0;
+		size_t max_steps_per_advance = 4;
+		overrun policy = overrun::skip;
+		std::function<void(const step_info &)> step;
+		uint64_t next_index = 0;
+		uint64_t num_steps = 0;
+		uint64_t num_skipped = 0;
+		size_t steps_last_advance = 0;
+		double last_ms = 0;
+		double mean_ms = 0;
+		double max_ms = 0;
+	};
+	struct schedule {
+		std::vector<subsystem> subsystems;
+		clock::time_point origin;
+		clock::duration budget = std::chrono::milliseconds(50);
+		bool started = false;
+		// Set when the last advance stopped on the budget rather than running out of due steps.
+		bool saturated = false;
+		uint64_t num_saturated = 0;
+	};
+	size_t add(schedule &target, const std::string &name, uint32_t rate, int order, overrun policy, size_t max_steps_per_advance, const std::function<void(const step_info &)> &step);
+	void start(schedule &target, clock::time_point now = clock::now());
+	void set_rate(schedule &target, size_t index, uint32_t rate);
+	void advance(schedule &target, clock::time_point now = clock::now());
+	clock::time_point step_end(const schedule &target, const subsystem &system, uint64_t index);
+	clock::time_point next_due(const schedule &target);
+	double interpolation(const schedule &target, size_t index, clock::time_point now = clock::now());
+	void reset_max(schedule &target);
+}
@@ -0,0 +1,227 @@
+#include "match.h"
+#include "meshes.h"
+#include "net.h"
+#include "jobs.h"
+#include "pack.h"
+#include "cfg.h"
+#include "sys.h"
+#include "misc.h"
+#include "scheduler.h"
+
+#include <iostream>
+#include <fmt/format.h>
+#include <chrono>
+#include <thread>
+#include <csignal>
+#include <atomic>
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+#include <memory>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <timeapi.h>
+#endif
+
+namespace cw {
+	void load_cfg();
+	void flush_cfg();
+}
+
+namespace cw::physics {
+	void shutdown();
+}
+
+namespace cw::meshes {
+	jobs::task_handle load_all(const jobs::task_handle &after, jobs::counter &progress);
+	void shutdown();
+}
+
+// Runs matches without a window: the fixed step, physics, prop collision and networking only.
+// Every match listens on its own port, counting up from the configured one, and all of them step
+// together on the job system. Started from a terminal or a process manager and stopped with
+// Ctrl+C or SIGTERM.
+
+namespace cw::server {
+	std::vector<std::string> args;
+	std::atomic<bool> quit_signal { false };
+	const auto report_interval = std::chrono::seconds(30);
+	uint32_t simulation_rate = 120;
+	uint32_t network_rate = 60;
+	uint32_t snapshot_rate = 30;
+	replication::precision snapshot_precision;
+	interest::settings interest_settings;
+	// ENet can't address more than 4095 peers on one host.
+	size_t max_peers = 64;
+	uint64_t reported_snapshot_bytes = 0;
+	scheduler::schedule schedule;
+	const size_t rollback_ticks = 64;
+	const size_t max_projectiles = 2048;
+	uint64_t tick = 0;
+	std::vector<std::unique_ptr<match::instance>> matches;
+	void load_props();
+	void on_simulation_step(const scheduler::step_info &info);
+	void on_network_step(const scheduler::step_info &info);
+	void on_snapshot_step(const scheduler::step_info &info);
+	void report();
+	void run();
+}
+
+std::filesystem::path cw::sys::bin_path() {
+	return std::filesystem::path(server::args[0]).remove_filename();
+}
+
+void cw::server::load_props() {
+	jobs::counter progress;
+	auto finished = meshes::load_all(nullptr, progress);
+	// Finalizing a prop is queued for the main thread like in the client, so this thread drains it.
+	while (!jobs::is_done(finished)) {
+		if (!jobs::run_main_thread_tasks(std::chrono::milliseconds(10))) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	std::cout << "Loaded collision for " << meshes::props.size() << " prop" << (meshes::props.size() == 1 ? "." : "s.") << std::endl;
+}
+
+void cw::server::on_simulation_step(const scheduler::step_info &info) {
+	jobs::parallel_for(0, matches.size(), 1, [&info](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) match::step(*matches[i], info.delta);
+	});
+	tick++;
+}
+
+void cw::server::on_network_step(const scheduler::step_info &info) {
+	for (auto &instance : matches) net::process(instance->host);
+}
+
+void cw::server::on_snapshot_step(const scheduler::step_info &info) {
+	jobs::parallel_for(0, matches.size(), 1, [](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) match::replicate(*matches[i]);
+	});
+}
+
+void cw::server::report() {
+	for (auto &system : schedule.subsystems) {
+		std::cout << "Subsystem \"" << system.name << "\" at " << system.rate << " Hz: " << fmt::format("{:.3f} ms mean, {:.3f} ms max", system.mean_ms, system.max_ms) << ", " << system.num_steps << " steps, " << system.num_skipped << " skipped." << std::endl;
+	}
+	uint64_t snapshot_bytes = 0;
+	size_t num_peers = 0;
+	for (auto &instance : matches) {
+		snapshot_bytes += instance->replication.bytes_sent;
+		num_peers += instance->replication.peers.size();
+	}
+	const double seconds = std::chrono::duration<double>(report_interval).count();
+	std::cout << "Sent " << fmt::format("{:.1f} KiB/s", (snapshot_bytes - reported_snapshot_bytes) / 1024.0 / seconds) << " of snapshots to " << num_peers << " peer" << (num_peers == 1 ? "." : "s.") << std::endl;
+	reported_snapshot_bytes = snapshot_bytes;
+	if (schedule.num_saturated) std::cout << "Ran out of step budget " << schedule.num_saturated << " time" << (schedule.num_saturated == 1 ? "." : "s.") << std::endl;
+	scheduler::reset_max(schedule);
+}
+
+// Sleeps until whichever subsystem is due next rather than waking at one fixed rate.
+void cw::server::run() {
+	scheduler::start(schedule);
+	auto next_report = scheduler::clock::now() + report_interval;
+	while (!quit_signal) {
+		scheduler::advance(schedule);
+		if (scheduler::clock::now() >= next_report) {
+			report();
+			next_report += report_interval;
+		}
+		misc::sleep_until(scheduler::next_due(schedule));
+	}
+}
+
+int main(int c, char **v) {
+	for (int i = 0; i < c; i++) cw::server::args.push_back(v[i]);
+	std::cout << "Binary Path: \"" << cw::sys::bin_path().string() << "\"" << std::endl;
+	std::signal(SIGINT, [](int) { cw::server::quit_signal = true; });
+	std::signal(SIGTERM, [](int) { cw::server::quit_signal = true; });
+	cw::load_cfg();
+	auto &server_cfg = cw::cfg["server"];
+	if (server_cfg.find("port") == server_cfg.end()) server_cfg["port"] = 4302;
+	if (server_cfg.find("matches") == server_cfg.end()) server_cfg["matches"] = 1;
+	if (server_cfg.find("simulation_rate") == server_cfg.end()) server_cfg["simulation_rate"] = cw::server::simulation_rate;
+	if (server_cfg.find("network_rate") == server_cfg.end()) server_cfg["network_rate"] = cw::server::network_rate;
+	if (server_cfg.find("snapshot_rate") == server_cfg.end()) server_cfg["snapshot_rate"] = cw::server::snapshot_rate;
+	if (server_cfg.find("position_precision") == server_cfg.end()) server_cfg["position_precision"] = cw::server::snapshot_precision.position_step;
+	if (server_cfg.find("orientation_bits") == server_cfg.end()) server_cfg["orientation_bits"] = cw::server::snapshot_precision.orientation_bits;
+	int port = server_cfg["port"];
+	cw::server::simulation_rate = std::max(1u, server_cfg["simulation_rate"].get<uint32_t>());
+	cw::server::network_rate = std::max(1u, server_cfg["network_rate"].get<uint32_t>());
+	cw::server::snapshot_rate = std::max(1u, server_cfg["snapshot_rate"].get<uint32_t>());
+	cw::server::snapshot_precision.position_step = std::max(1e-5f, server_cfg["position_precision"].get<float>());
+	cw::server::snapshot_precision.orientation_bits = std::clamp(server_cfg["orientation_bits"].get<uint32_t>(), 4u, 10u);
+	if (server_cfg.find("max_peers") == server_cfg.end()) server_cfg["max_peers"] = cw::server::max_peers;
+	if (server_cfg.find("interest") == server_cfg.end()) {
+		auto tiers = nlohmann::json::array();
+		for (auto &tier : cw::server::interest_settings.tiers) tiers.push_back({ { "radius", tier.radius }, { "interval", tier.interval } });
+		server_cfg["interest"] = { { "cell_size", cw::server::interest_settings.cell_size }, { "hysteresis", cw::server::interest_settings.hysteresis }, { "tiers", tiers } };
+	}
+	cw::server::max_peers = std::clamp(server_cfg["max_peers"].get<size_t>(), size_t(1), size_t(4095));
+	auto &interest_cfg = server_cfg["interest"];
+	cw::server::interest_settings.cell_size = std::max(1.0f, interest_cfg.value("cell_size", cw::server::interest_settings.cell_size));
+	cw::server::interest_settings.hysteresis = std::max(0.0f, interest_cfg.value("hysteresis", cw::server::interest_settings.hysteresis));
+	if (interest_cfg.contains("tiers")) {
+		cw::server::interest_settings.tiers.clear();
+		for (auto &tier : interest_cfg["tiers"]) cw::server::interest_settings.tiers.push_back({ tier.value("radius", 0.0f), std::max(1u, tier.value("interval", 1u)) });
+		// Selection relies on the tiers going outwards.
+		std::sort(cw::server::interest_settings.tiers.begin(), cw::server::interest_settings.tiers.end(), [](const auto &a, const auto &b) { return a.radius < b.radius; });
+		// Tiers are remembered as a byte, with 255 meaning none.
+		if (cw::server::interest_settings.tiers.size() > 255) cw::server::interest_settings.tiers.resize(255);
+	}
+	int num_matches = server_cfg["matches"];
+	for (int i = 1; i + 1 < c; i++) {
+		if (std::string(v[i]) == "--port") port = std::stoi(v[++i]);
+		else if (std::string(v[i]) == "--matches") num_matches = std::stoi(v[++i]);
+	}
+	num_matches = std::max(1, num_matches);
+	if (port < 0 || port + num_matches - 1 > std::numeric_limits<uint16_t>::max()) {
+		std::cout << "Cannot host. Specified port is out of range." << std::endl;
+		return 1;
+	}
+	if (enet_initialize() < 0) {
+		std::cout << "Failed to startup ENet." << std::endl;
+		return 2;
+	}
+#ifdef _WIN32
+	// The default 15.6 ms scheduler tick would swallow a whole fixed step.
+	timeBeginPeriod(1);
+#endif
+	cw::pack::initialize(cw::sys::bin_path());
+	cw::pack::mount(cw::sys::bin_path() / "assets.pack");
+	cw::jobs::initialize();
+	cw::server::load_props();
+	// With several matches the parallelism comes from stepping them side by side, so each world stays single threaded.
+	const int physics_threads = num_matches > 1 ? 1 : cw::physics::configured_threads();
+	for (int i = 0; i < num_matches; i++) {
+		auto instance = std::make_unique<cw::match::instance>();
+		cw::match::create(*instance, fmt::format("match_{}", i), physics_threads, cw::server::rollback_ticks, cw::server::max_projectiles);
+		instance->replication.settings = cw::server::snapshot_precision;
+		instance->replication.simulation_rate = cw::server::simulation_rate;
+		instance->interest = cw::server::interest_settings;
+		cw::net::become_server(instance->host, static_cast<uint16_t>(port + i), cw::server::max_peers);
+		if (instance->host.current_state == cw::net::state::server) cw::server::matches.push_back(std::move(instance));
+		else cw::match::destroy(*instance);
+	}
+	// The simulation may fall up to a second behind and catch up a few steps at a time, an authoritative
+	// clock that quietly skips would desync every client. Networking just drops what it missed.
+	cw::scheduler::add(cw::server::schedule, "simulation", cw::server::simulation_rate, 0, cw::scheduler::overrun::defer, 8, cw::server::on_simulation_step);
+	cw::scheduler::add(cw::server::schedule, "network", cw::server::network_rate, 1, cw::scheduler::overrun::skip, 1, cw::server::on_network_step);
+	cw::scheduler::add(cw::server::schedule, "snapshots", cw::server::snapshot_rate, 2, cw::scheduler::overrun::skip, 1, cw::server::on_snapshot_step);
+	if (cw::server::matches.size()) cw::server::run();
+	else std::cout << "No match could start hosting." << std::endl;
+	std::cout << "Shutting down after " << cw::server::tick << " ticks." << std::endl;
+	for (auto &instance : cw::server::matches) cw::match::destroy(*instance);
+	cw::server::matches.clear();
+	cw::meshes::shutdown();
+	cw::physics::shutdown();
+	cw::jobs::shutdown();
+	cw::flush_cfg();
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+	enet_deinitialize();
+	return 0;
+}
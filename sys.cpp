@@ -19,10 +19,22 @@
 #include <thread>
 #include <csignal>
 #include <map>
+#include <optional>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <limits>
 
 #include "sys.h"
 #include "cfg.h"
 #include "misc.h"
+#include "jobs.h"
+#include "pack.h"
+#include "pacer.h"
+#include "input.h"
+#include "scheduler.h"
+#include "replay.h"
+#include "net.h"
 
 namespace cw {
 	extern std::map<std::string, nlohmann::json> cfg;
@@ -30,11 +42,6 @@ namespace cw {
 	void flush_cfg();
 }
 
-namespace cw::net {
-	void process();
-	void shutdown();
-}
-
 namespace cw::sys {
 	bool enable_mouse_grab = false;
 	float mouse_look_sensitivity = 0.01;
@@ -46,26 +53,48 @@ namespace cw::sys {
 	bool imgui_sdl_impl_initialized = false;
 	bool imgui_opengl3_impl_initialized = false;
 	bool enet_initialized = false;
-	const uint64_t fixed_steps_per_second = 60;
-	uint64_t performance_frequency = 0;
-	uint64_t last_performance_counter = 0;
+	scheduler::schedule schedule;
+	size_t simulation = 0;
+	uint32_t simulation_rate = 60;
+	uint32_t network_rate = 60;
+	scheduler::clock::time_point last_frame;
 	double variable_time_delta = 0;
-	const double fixed_step_time_delta = 1. / fixed_steps_per_second;
-	uint64_t num_performance_counters_per_fixed_step = 0;
-	uint64_t fixed_step_counter_remainder = 0;
-	uint64_t fixed_step_performance_counter = 0;
-	bool is_performance_optimal = true;
 	uint64_t current_tick_iteration = 0;
+	std::filesystem::path record_path;
+	std::filesystem::path replay_path;
+	bool replay_rendering = true;
+	// Take the place of the recorded session's peers, by their ids at the time. Zeroed, so never connected.
+	std::map<uint16_t, ENetPeer> stand_in_peers;
+	// What the recording host was to its peers, from the replay's "host_role" setting.
+	net::state replay_role = net::state::client;
 	double interpolation_delta = 0;
+	bool quit_requested = false;
+	uint64_t input_time(scheduler::clock::time_point time);
+	void pump_input();
+	void on_simulation_step(const scheduler::step_info &info);
+	void set_simulation_rate(uint32_t rate);
+	void draw();
 	bool tick();
+	bool replay_tick();
+	void begin_replay();
 	void kill();
 	void apply_imgui_theme();
 	namespace preload {
-		std::map<size_t, int> images;
-		size_t current_image = 0;
-		uint32_t last_update = 0;
+		GLuint flipbook = 0;
+		glm::ivec2 flipbook_size { 0, 0 };
+		glm::ivec2 frame_size { 0, 0 };
+		size_t flipbook_columns = 1;
+		std::vector<bool> frame_uploaded;
+		size_t num_ready_frames = 0;
+		uint32_t start_ticks = 0;
+		const uint32_t milliseconds_per_image = 30;
+		const uint32_t milliseconds_per_frame = 16;
+		const uint32_t main_thread_budget_microseconds = 8000;
+		std::optional<std::vector<unsigned char>> decode_frame(const std::string &name, glm::ivec2 &size);
+		void upload_frame(size_t index, const std::vector<unsigned char> &pixels);
 		void begin();
-		void update();
+		void render(float progress);
+		bool run_until(const jobs::task_handle &finished, const jobs::counter &progress);
 		void end();
 	}
 }
@@ -93,78 +122,73 @@ namespace cw::physics {
 }
 
 namespace cw::local_player {
-	extern bool binary_input[4];
+	void consume_input(uint64_t until);
 }
 
 std::filesystem::path cw::sys::bin_path() {
 	return std::filesystem::path(args[0]).remove_filename();
 }
 
-bool cw::sys::tick() {
+// Input events and step slices share one timeline, steady clock nanoseconds.
+uint64_t cw::sys::input_time(scheduler::clock::time_point time) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+// Window and debug keys are handled right away, gameplay input is queued with the time it was
+// collected for the fixed steps to consume. Mouse look also turns the camera immediately so the
+// rendered view never waits for the next fixed step.
+void cw::sys::pump_input() {
 	SDL_Event os_event;
-	bool quit_signal = false;
 	assert(SDL_SetRelativeMouseMode(enable_mouse_grab ? SDL_TRUE : SDL_FALSE) == 0);
+	const uint64_t now = input_time(scheduler::clock::now());
+	auto queue = [now](input::kind type, input::action code, float x = 0, float y = 0) {
+		input::push({ now, type, code, x, y });
+	};
+	auto key_action = [](SDL_Keycode key) -> std::optional<input::action> {
+		if (key == SDLK_w) return input::action::move_forward;
+		if (key == SDLK_a) return input::action::move_left;
+		if (key == SDLK_s) return input::action::move_back;
+		if (key == SDLK_d) return input::action::move_right;
+		if (key == SDLK_1) return input::action::equip_personal_defense_gun;
+		if (key == SDLK_2) return input::action::equip_grenade_launcher;
+		return std::nullopt;
+	};
 	while (SDL_PollEvent(&os_event)) {
 		ImGui_ImplSDL2_ProcessEvent(&os_event);
-		if (os_event.type == SDL_QUIT) quit_signal = true;
+		if (os_event.type == SDL_QUIT) quit_requested = true;
 		else if (os_event.type == SDL_MOUSEMOTION) {
-			if (enable_mouse_grab) core::on_relative_mouse_input(os_event.motion.xrel, os_event.motion.yrel);
+			if (!enable_mouse_grab) continue;
+			core::on_relative_mouse_input(os_event.motion.xrel, os_event.motion.yrel);
+			queue(input::kind::look, input::action::none, os_event.motion.xrel * mouse_look_sensitivity, os_event.motion.yrel * mouse_look_sensitivity);
+		} else if (os_event.type == SDL_MOUSEBUTTONDOWN) {
+			if (os_event.button.button == SDL_BUTTON_LEFT && enable_mouse_grab) queue(input::kind::press, input::action::fire);
+		} else if (os_event.type == SDL_MOUSEBUTTONUP) {
+			if (os_event.button.button == SDL_BUTTON_LEFT) queue(input::kind::release, input::action::fire);
 		} else if (os_event.type == SDL_KEYDOWN) {
 			if (os_event.key.keysym.sym == SDLK_F1 && os_event.key.repeat == 0) enable_mouse_grab = !enable_mouse_grab;
 			if (os_event.key.keysym.sym == SDLK_F2 && os_event.key.repeat == 0) SDL_SetWindowFullscreen(sdl_window, SDL_GetWindowFlags(sdl_window) & SDL_WINDOW_FULLSCREEN ? 0 : SDL_WINDOW_FULLSCREEN);
-			if (os_event.key.keysym.sym == SDLK_w) local_player::binary_input[0] = true;
-			if (os_event.key.keysym.sym == SDLK_a) local_player::binary_input[1] = true;
-			if (os_event.key.keysym.sym == SDLK_s) local_player::binary_input[2] = true;
-			if (os_event.key.keysym.sym == SDLK_d) local_player::binary_input[3] = true;
+			if (auto action = key_action(os_event.key.keysym.sym); action && os_event.key.repeat == 0) queue(input::kind::press, *action);
 		} else if (os_event.type == SDL_KEYUP) {
-			if (os_event.key.keysym.sym == SDLK_w) local_player::binary_input[0] = false;
-			if (os_event.key.keysym.sym == SDLK_a) local_player::binary_input[1] = false;
-			if (os_event.key.keysym.sym == SDLK_s) local_player::binary_input[2] = false;
-			if (os_event.key.keysym.sym == SDLK_d) local_player::binary_input[3] = false;
+			if (auto action = key_action(os_event.key.keysym.sym)) queue(input::kind::release, *action);
 		}
 	}
+}
+
+// Runs the gameplay step with exactly the input collected during its slice.
+void cw::sys::on_simulation_step(const scheduler::step_info &info) {
+	local_player::consume_input(input_time(info.end));
+	core::on_fixed_step(info.delta);
+	current_tick_iteration++;
+}
+
+// Camera, scene, debug windows and the swap, from the simulation state as it stands.
+void cw::sys::draw() {
 	int w, h;
 	SDL_GL_GetDrawableSize(sdl_window, &w, &h);
 	if (!(gpu::render_target_size.x == w && gpu::render_target_size.y == h)) {
 		gpu::render_target_size = { w, h };
 		gpu::generate_render_targets();
 	}
-	if (!performance_frequency) {
-		performance_frequency = SDL_GetPerformanceFrequency();
-		num_performance_counters_per_fixed_step = performance_frequency / fixed_steps_per_second;
-		last_performance_counter = SDL_GetPerformanceCounter();
-		fixed_step_performance_counter = last_performance_counter;
-		return true;
-	}
-	const uint64_t performance_counter = SDL_GetPerformanceCounter();
-	const uint64_t elapsed_performance_counter = performance_counter - last_performance_counter;
-	fixed_step_counter_remainder += elapsed_performance_counter;
-	uint32_t num_fixed_steps_this_i = 0;
-	while (fixed_step_counter_remainder >= num_performance_counters_per_fixed_step) {
-		core::on_fixed_step(fixed_step_time_delta);
-		fixed_step_performance_counter += num_performance_counters_per_fixed_step;
-		fixed_step_counter_remainder -= num_performance_counters_per_fixed_step;
-		num_fixed_steps_this_i++;
-		current_tick_iteration++;
-		if (num_fixed_steps_this_i >= 10) {
-			std::cout << "Fixed update is saturated. Accumulated " << fixed_step_counter_remainder << " on tick #" << current_tick_iteration << ". " << num_fixed_steps_this_i << " steps this frame." << std::endl;
-			break;
-		}
-	}
-	is_performance_optimal = num_fixed_steps_this_i <= 1;
-	last_performance_counter = performance_counter;
-	variable_time_delta = static_cast<double>(elapsed_performance_counter) / performance_frequency;
-	interpolation_delta = 0;
-	const uint64_t next_fixed_step_expected_counter = fixed_step_performance_counter + num_performance_counters_per_fixed_step;
-	if (performance_counter >= next_fixed_step_expected_counter) {
-		interpolation_delta = 1;
-		std::cout << "Interpolation not possible this frame." << std::endl;
-	}
-	else {
-		const uint64_t progress_towards_next_fixed_step = (fixed_step_performance_counter + num_performance_counters_per_fixed_step) - performance_counter;
-		interpolation_delta = 1.0 - (static_cast<double>(progress_towards_next_fixed_step) / static_cast<double>(num_performance_counters_per_fixed_step));
-	}
-	net::process();
 	core::on_update(variable_time_delta, interpolation_delta);
 	gpu::render();
 	ImGui_ImplOpenGL3_NewFrame();
@@ -175,20 +199,121 @@ bool cw::sys::tick() {
 	ImGui::Text(static_cast<std::string>(fmt::format("Frame Delta: {}", variable_time_delta)).c_str());
 	ImGui::Text(static_cast<std::string>(fmt::format("Frame Time: {}", static_cast<int>(variable_time_delta * 1000.0))).c_str());
 	ImGui::Text(static_cast<std::string>(fmt::format("Frames Per Second: {}", static_cast<int>(1.0 / variable_time_delta))).c_str());
-	ImGui::Text(static_cast<std::string>(fmt::format("Fixed Steps Per Second: {}", fixed_steps_per_second)).c_str());
-	ImGui::Text(static_cast<std::string>(fmt::format("Performance Frequency: {}", performance_frequency)).c_str());
-	ImGui::Text(static_cast<std::string>(fmt::format("Last Performance Counter: {}", last_performance_counter)).c_str());
-	ImGui::Text(static_cast<std::string>(fmt::format("Variable Time Delta: {}", variable_time_delta)).c_str());
-	ImGui::Text(static_cast<std::string>(fmt::format("Fixed Step Time Delta: {}", fixed_step_time_delta)).c_str());
-	ImGui::Text(static_cast<std::string>(fmt::format("Performance Counters Per Fixed Step: {}", num_performance_counters_per_fixed_step)).c_str());
-	ImGui::Text(static_cast<std::string>(fmt::format("Fixed Step Counter Remainder: {}", fixed_step_counter_remainder)).c_str());
-	ImGui::Text(static_cast<std::string>(fmt::format("Optimal Performance: {}", is_performance_optimal ? "Yes" : "No")).c_str());
+	for (auto &system : schedule.subsystems) {
+		ImGui::Text(static_cast<std::string>(fmt::format("{}: {} Hz, {} steps, {} skipped", system.name, system.rate, system.num_steps, system.num_skipped)).c_str());
+		ImGui::Text(static_cast<std::string>(fmt::format("    {:.3f} ms (mean {:.3f} ms, max {:.3f} ms)", system.last_ms, system.mean_ms, system.max_ms)).c_str());
+	}
+	ImGui::Text(static_cast<std::string>(fmt::format("Saturated Frames: {}", schedule.num_saturated)).c_str());
+	if (ImGui::Button("Reset Step Maximums")) scheduler::reset_max(schedule);
 	ImGui::Text(static_cast<std::string>(fmt::format("Tick: {}", current_tick_iteration)).c_str());
+	if (replay::current_mode == replay::mode::recording) ImGui::Text(static_cast<std::string>(fmt::format("Recording: {} ticks", replay::num_ticks)).c_str());
+	else if (replay::current_mode == replay::mode::playing) ImGui::Text(static_cast<std::string>(fmt::format("Replaying: {} ticks, {} hashes matched, {} didn't", replay::num_ticks, replay::num_verified, replay::num_mismatches)).c_str());
+	ImGui::Text(static_cast<std::string>(fmt::format("Queued Input Events: {} ({} dropped)", input::size(), input::num_dropped)).c_str());
+	if (pacer::target_fps > 0) {
+		ImGui::Text(static_cast<std::string>(fmt::format("Target Frame Rate: {}", pacer::target_fps)).c_str());
+		ImGui::Text(static_cast<std::string>(fmt::format("Pacing Error: {:.3f} ms (mean {:.3f} ms)", pacer::last_error_ms, pacer::mean_absolute_error_ms)).c_str());
+		ImGui::Text(static_cast<std::string>(fmt::format("Late Work Estimate: {:.3f} ms", pacer::late_work_estimate_ms)).c_str());
+		ImGui::PlotLines("Pacing Error", pacer::error_history, static_cast<int>(pacer::error_history_length), 0, 0, -2, 2, ImVec2(0, 40));
+	} else ImGui::Text("Target Frame Rate: VSync");
 	ImGui::End();
 	ImGui::Render();
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 	SDL_GL_SwapWindow(sdl_window);
-	return !quit_signal;
+}
+
+// A server we join decides how fast the simulation steps, prediction only works when both agree.
+// A replay steps at whatever rate the recording did, so a server's rate arriving in a played back
+// welcome changes the playback rate too.
+void cw::sys::set_simulation_rate(uint32_t rate) {
+	if (!rate) return;
+	simulation_rate = rate;
+	scheduler::set_rate(schedule, simulation, rate);
+	if (replay::current_mode == replay::mode::playing) replay::simulation_rate = rate;
+}
+
+// Simulation first, then the pacer's wait, then everything that decides what ends up on screen:
+// input, the camera, drawing and the swap. That keeps the newest mouse movement as close to the
+// present as the frame budget allows.
+bool cw::sys::tick() {
+	// Picks up main thread work queued late, such as loading animation frames that missed the loading screen.
+	jobs::run_main_thread_tasks(std::chrono::microseconds(1000));
+	pump_input();
+	const auto now = scheduler::clock::now();
+	if (!schedule.started) {
+		scheduler::start(schedule, now);
+		last_frame = now;
+		return !quit_requested;
+	}
+	scheduler::advance(schedule, now);
+	variable_time_delta = std::chrono::duration<double>(now - last_frame).count();
+	last_frame = now;
+	// Keeps collecting input while waiting, so events carry a time close to when they really happened.
+	pacer::wait_for_late_work(pump_input);
+	pump_input();
+	// Interpolated for the moment the frame is drawn, not for when the fixed steps ran.
+	interpolation_delta = scheduler::interpolation(schedule, simulation);
+	draw();
+	pacer::frame_presented();
+	return !quit_requested;
+}
+
+// Steps the recording back to back, as fast as the simulation goes. With rendering each frame gets
+// about a frame's worth of steps first, without it the window is only kept responding.
+bool cw::sys::replay_tick() {
+	jobs::run_main_thread_tasks(std::chrono::microseconds(1000));
+	pump_input();
+	// Live input has no say over a replay.
+	input::event discarded;
+	while (input::pop_until(std::numeric_limits<uint64_t>::max(), discarded));
+	const auto now = scheduler::clock::now();
+	const auto frame_end = now + (replay_rendering ? std::chrono::milliseconds(16) : std::chrono::milliseconds(100));
+	variable_time_delta = std::chrono::duration<double>(now - last_frame).count();
+	last_frame = now;
+	while (!replay::finished() && scheduler::clock::now() < frame_end) {
+		if (!replay::play_tick()) break;
+		// Whatever the network delivered before this tick goes through the same handlers it did live.
+		for (auto &event : replay::played_network_events) {
+			auto &peer = stand_in_peers[event.peer];
+			net::play_event(net::default_host, replay_role, static_cast<ENetEventType>(event.type), &peer, reinterpret_cast<const uint8_t *>(event.payload.data()), event.payload.size());
+		}
+		core::on_fixed_step(1.0 / replay::simulation_rate);
+		current_tick_iteration++;
+	}
+	if (replay::finished()) quit_requested = true;
+	if (!replay_rendering) return !quit_requested;
+	interpolation_delta = 1;
+	draw();
+	return !quit_requested;
+}
+
+// Starts whichever of --replay and --record was asked for, once the world is ready for its first step.
+void cw::sys::begin_replay() {
+	if (!replay_path.empty()) {
+		if (!replay::begin_playback(replay_path)) return;
+		last_frame = scheduler::clock::now();
+		if (replay::settings.value("physics_threads", -1) != cfg["system"]["physics_threads"].get<int>()) std::cout << "Replay was recorded with a different physics thread count, it may not play back identically." << std::endl;
+		replay_role = replay::settings.value("host_role", "client") == "server" ? net::state::server : net::state::client;
+		return;
+	}
+	if (record_path.empty()) return;
+	replay::begin_recording(record_path, simulation_rate, {
+		{ "simulation_rate", simulation_rate },
+		{ "physics_threads", cfg["system"]["physics_threads"].get<int>() }
+	});
+	net::default_host.observer = [](const ENetEvent &event) {
+		// Seen before it's handled, so a client's first connection still finds the host connecting.
+		if (event.type == ENET_EVENT_TYPE_CONNECT) {
+			const std::string role = net::default_host.current_state == net::state::server ? "server" : "client";
+			if (!replay::settings.contains("host_role")) replay::settings["host_role"] = role;
+			else if (replay::settings["host_role"] != role) std::cout << "Recording already holds a session as " << replay::settings["host_role"].get<std::string>() << ", this one as " << role << " won't play back as it was." << std::endl;
+		}
+		replay::network_event recorded;
+		recorded.type = static_cast<uint8_t>(event.type);
+		recorded.peer = event.peer ? event.peer->incomingPeerID : 0;
+		recorded.channel = event.channelID;
+		if (event.type == ENET_EVENT_TYPE_RECEIVE && event.packet) recorded.payload.assign(event.packet->data, event.packet->data + event.packet->dataLength);
+		replay::record_network_event(recorded);
+	};
 }
 
 void cw::sys::kill() {
@@ -297,38 +422,78 @@ void cw::sys::apply_imgui_theme() {
 	colors[ImGuiCol_ModalWindowDimBg] = ImVec4(0.80f, 0.80f, 0.80f, 0.35f);
 }
 
+std::optional<std::vector<unsigned char>> cw::sys::preload::decode_frame(const std::string &name, glm::ivec2 &size) {
+	auto file_contents = pack::open(name);
+	if (!file_contents) return std::nullopt;
+	int image_channels;
+	unsigned char *image_data = stbi_load_from_memory(
+		reinterpret_cast<const unsigned char *>(file_contents->data),
+		file_contents->size,
+		&size.x, &size.y, &image_channels, STBI_rgb
+	);
+	if (!image_data) return std::nullopt;
+	std::vector<unsigned char> pixels(image_data, image_data + size.x * size.y * 3);
+	stbi_image_free(image_data);
+	return pixels;
+}
+
+void cw::sys::preload::upload_frame(size_t index, const std::vector<unsigned char> &pixels) {
+	if (!flipbook) return;
+	glBindTexture(GL_TEXTURE_2D, flipbook);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, (index % flipbook_columns) * frame_size.x, (index / flipbook_columns) * frame_size.y, frame_size.x, frame_size.y, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	frame_uploaded[index] = true;
+	while (num_ready_frames < frame_uploaded.size() && frame_uploaded[num_ready_frames]) num_ready_frames++;
+}
+
 void cw::sys::preload::begin() {
-	for (auto &file : std::filesystem::directory_iterator(bin_path().string() + "texture\\loading")) {
-		auto file_contents = misc::read_file(file);
-		assert(file_contents);
-		int image_width, image_height, image_channels;
-		unsigned char *image_data = stbi_load_from_memory(
-			reinterpret_cast<unsigned char *>(file_contents->data()),
-			file_contents->size(),
-			&image_width, &image_height, &image_channels, STBI_rgb
-		);
-		assert(image_data);
-		assert(image_channels == 3);
-		GLuint texture;
-		glGenTextures(1, &texture);
-		assert(texture);
-		glBindTexture(GL_TEXTURE_2D, texture);
+	auto names = pack::list("texture/loading");
+	std::sort(names.begin(), names.end(), [](const std::string &a, const std::string &b) {
+		return std::stoi(std::filesystem::path(a).stem().string()) < std::stoi(std::filesystem::path(b).stem().string());
+	});
+	std::optional<std::vector<unsigned char>> first_frame;
+	if (!names.empty()) first_frame = decode_frame(names.front(), frame_size);
+	if (first_frame) {
+		// Every frame shares one atlas, laid out as close to square as the GL size limit allows.
+		GLint max_texture_size = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+		flipbook_columns = std::max<size_t>(1, std::min<size_t>(std::ceil(std::sqrt(static_cast<double>(names.size()))), max_texture_size / frame_size.x));
+		auto max_rows = static_cast<size_t>(max_texture_size / frame_size.y);
+		names.resize(std::min(names.size(), flipbook_columns * max_rows));
+		auto rows = (names.size() + flipbook_columns - 1) / flipbook_columns;
+		flipbook_size = { static_cast<int>(flipbook_columns) * frame_size.x, static_cast<int>(rows) * frame_size.y };
+		glGenTextures(1, &flipbook);
+		assert(flipbook);
+		glBindTexture(GL_TEXTURE_2D, flipbook);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image_width, image_height, 0, GL_RGB, GL_UNSIGNED_BYTE, image_data);
-		stbi_image_free(image_data);
-		int index;
-		std::stringstream(file.path().stem().string()) >> index;
-		images[index] = texture;
-	}
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, flipbook_size.x, flipbook_size.y, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+		frame_uploaded.assign(names.size(), false);
+		num_ready_frames = 0;
+		upload_frame(0, *first_frame);
+	} else std::cout << "Loading animation is missing, continuing without it." << std::endl;
 	SDL_GL_SetSwapInterval(0);
 	SDL_ShowWindow(sdl_window);
+	start_ticks = SDL_GetTicks();
+	render(0);
+	// The other frames are decoded on workers and uploaded in the loading screen's main thread slices.
+	for (size_t i = 1; i < frame_uploaded.size(); i++) {
+		auto pixels = std::make_shared<std::vector<unsigned char>>();
+		auto decode = jobs::make_task([name = names[i], pixels]() {
+			glm::ivec2 size;
+			auto decoded = decode_frame(name, size);
+			if (decoded && size == frame_size) *pixels = std::move(*decoded);
+			else std::cout << "Skipping unusable loading animation frame: \"" << name << "\"" << std::endl;
+		});
+		auto upload = jobs::make_task([i, pixels]() { if (!pixels->empty()) upload_frame(i, *pixels); }, true);
+		jobs::depend(upload, decode);
+		jobs::launch(upload);
+		jobs::launch(decode);
+	}
 }
 
-void cw::sys::preload::update() {
-	if (SDL_GetTicks() < last_update + 30) return;
-	SDL_Event os_event;
-	SDL_PollEvent(&os_event);
+void cw::sys::preload::render(float progress) {
 	int window_size[2];
 	SDL_GL_GetDrawableSize(sdl_window, &window_size[0], &window_size[1]);
 	glClearColor(0, 0, 0, 1);
@@ -339,21 +504,50 @@ void cw::sys::preload::update() {
 	auto image_size = ImVec2(270, 270);
 	auto image_position = ImVec2((window_size[0] / 2) - (image_size.x / 2), (window_size[1] / 2) - (image_size.y / 2));
 	auto image_extent = ImVec2(image_position.x + image_size.x, image_position.y + image_size.y);
-	if (current_image >= images.size()) current_image = 0;
-	ImGui::GetBackgroundDrawList()->AddImage(
-		reinterpret_cast<void *>(images[current_image]),
-		image_position, image_extent,
-		ImVec2(0, 0), ImVec2(1, 1),
-		IM_COL32(255, 255, 255, 255));
+	if (num_ready_frames) {
+		// Frames still streaming in are skipped by looping over the ones that are ready so far.
+		auto current_image = ((SDL_GetTicks() - start_ticks) / milliseconds_per_image) % num_ready_frames;
+		auto frame_position = glm::vec2((current_image % flipbook_columns) * frame_size.x, (current_image / flipbook_columns) * frame_size.y);
+		auto uv_min = frame_position / glm::vec2(flipbook_size);
+		auto uv_max = (frame_position + glm::vec2(frame_size)) / glm::vec2(flipbook_size);
+		ImGui::GetBackgroundDrawList()->AddImage(
+			reinterpret_cast<void *>(static_cast<intptr_t>(flipbook)),
+			image_position, image_extent,
+			ImVec2(uv_min.x, uv_min.y), ImVec2(uv_max.x, uv_max.y),
+			IM_COL32(255, 255, 255, 255));
+	}
+	auto bar_position = ImVec2(image_position.x, image_extent.y + 8);
+	ImGui::GetBackgroundDrawList()->AddRectFilled(bar_position, ImVec2(image_extent.x, bar_position.y + 4), IM_COL32(40, 40, 40, 255));
+	ImGui::GetBackgroundDrawList()->AddRectFilled(bar_position, ImVec2(bar_position.x + image_size.x * progress, bar_position.y + 4), IM_COL32(150, 137, 46, 255));
 	ImGui::Render();
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 	SDL_GL_SwapWindow(sdl_window);
-	last_update = SDL_GetTicks();
-	current_image++;
 }
 
-void cw::sys::preload::end() {
+// False if the window was closed before `finished` was done.
+bool cw::sys::preload::run_until(const jobs::task_handle &finished, const jobs::counter &progress) {
+	uint32_t last_frame = 0;
+	while (!jobs::is_done(finished)) {
+		// Main thread work (mostly GL uploads) gets a fixed slice so frames keep coming at a steady rate.
+		auto num_ran = jobs::run_main_thread_tasks(std::chrono::microseconds(main_thread_budget_microseconds));
+		SDL_Event os_event;
+		while (SDL_PollEvent(&os_event)) if (os_event.type == SDL_QUIT) quit_requested = true;
+		if (quit_requested) return false;
+		if (SDL_GetTicks() >= last_frame + milliseconds_per_frame) {
+			last_frame = SDL_GetTicks();
+			size_t total = progress.total, completed = progress.completed;
+			render(total ? static_cast<float>(completed) / total : 0.f);
+		} else if (!num_ran) SDL_Delay(1);
+	}
+	return true;
+}
 
+void cw::sys::preload::end() {
+	// Uploads still queued find the atlas gone and drop their pixels.
+	if (flipbook) glDeleteTextures(1, &flipbook);
+	flipbook = 0;
+	frame_uploaded.clear();
+	num_ready_frames = 0;
 }
 
 int main(int c, char **v) {
@@ -361,6 +555,11 @@ int main(int c, char **v) {
 		std::cout << "v[" << i << "] -> \"" << v[i] << "\"" << std::endl;
 		cw::sys::args.push_back(v[i]);
 	}
+	for (int i = 1; i < c; i++) {
+		if (std::string(v[i]) == "--record" && i + 1 < c) cw::sys::record_path = v[++i];
+		else if (std::string(v[i]) == "--replay" && i + 1 < c) cw::sys::replay_path = v[++i];
+		else if (std::string(v[i]) == "--no-render") cw::sys::replay_rendering = false;
+	}
 	std::cout << "Working Area: \"" << std::filesystem::current_path().string() << "\"" << std::endl;
 	std::cout << "Binary Path: \"" << cw::sys::bin_path().string() << "\"" << std::endl;
 	if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
@@ -443,29 +642,52 @@ int main(int c, char **v) {
 	std::cout << "ENet is ready." << std::endl;
 	cw::sys::enet_initialized = true;
 	cw::sys::apply_imgui_theme();
+	cw::pack::initialize(cw::sys::bin_path());
+	cw::pack::mount(cw::sys::bin_path() / "assets.pack");
+	cw::jobs::initialize();
 	cw::sys::preload::begin();
 	cw::load_cfg();
 	if (auto &system_cfg = cw::cfg["system"]; system_cfg.find("resolution") == system_cfg.end()) system_cfg["resolution"] = { { "w", 640 }, { "h", 480 } };
 	if (auto &system_cfg = cw::cfg["system"]; system_cfg.find("mouse_look_sensitivity") == system_cfg.end()) system_cfg["mouse_look_sensitivity"] = cw::sys::mouse_look_sensitivity;
 	cw::sys::mouse_look_sensitivity = cw::cfg["system"]["mouse_look_sensitivity"];
+	if (auto &system_cfg = cw::cfg["system"]; system_cfg.find("target_fps") == system_cfg.end()) system_cfg["target_fps"] = cw::pacer::target_fps;
+	cw::pacer::configure(cw::cfg["system"]["target_fps"]);
+	if (auto &system_cfg = cw::cfg["system"]; system_cfg.find("simulation_rate") == system_cfg.end()) system_cfg["simulation_rate"] = cw::sys::simulation_rate;
+	if (auto &system_cfg = cw::cfg["system"]; system_cfg.find("network_rate") == system_cfg.end()) system_cfg["network_rate"] = cw::sys::network_rate;
+	cw::sys::simulation_rate = std::max(1u, cw::cfg["system"]["simulation_rate"].get<uint32_t>());
+	cw::sys::network_rate = std::max(1u, cw::cfg["system"]["network_rate"].get<uint32_t>());
+	// Rollback, projectiles and the local player all hang off the one simulation step, so it isn't split further here.
+	cw::sys::simulation = cw::scheduler::add(cw::sys::schedule, "simulation", cw::sys::simulation_rate, 0, cw::scheduler::overrun::skip, 10, cw::sys::on_simulation_step);
+	cw::scheduler::add(cw::sys::schedule, "network", cw::sys::network_rate, 1, cw::scheduler::overrun::skip, 1, [](const cw::scheduler::step_info &) {
+		// A replay brings its own network events, the live connection has no say over it.
+		if (cw::replay::current_mode != cw::replay::mode::playing) cw::net::process(cw::net::default_host);
+	});
 	SDL_SetWindowSize(cw::sys::sdl_window, cw::cfg["system"]["resolution"]["w"], cw::cfg["system"]["resolution"]["h"]);
 	SDL_SetWindowPosition(cw::sys::sdl_window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
 	if (!cw::gpu::initialize()) {
+		cw::jobs::shutdown();
 		cw::sys::kill();
-		return 10;
+		// Closing the window while loading isn't a failure.
+		return cw::sys::quit_requested ? 0 : 10;
 	}
 	cw::physics::initialize();
 	cw::core::initialize();
 	cw::sys::preload::end();
-	SDL_GL_SetSwapInterval(1);
-	while (cw::sys::tick());
+	SDL_GL_SetSwapInterval(cw::pacer::target_fps > 0 ? 0 : 1);
+	cw::sys::begin_replay();
+	if (cw::replay::current_mode == cw::replay::mode::playing) while (cw::sys::replay_tick());
+	else while (cw::sys::tick());
+	cw::replay::end();
+	cw::net::default_host.observer = nullptr;
 	SDL_HideWindow(cw::sys::sdl_window);
 	cw::cfg["system"]["mouse_look_sensitivity"] = cw::sys::mouse_look_sensitivity;
 	cw::core::shutdown();
 	cw::physics::shutdown();
 	cw::gpu::shutdown();
 	cw::flush_cfg();
-	cw::net::shutdown();
+	cw::net::shutdown(cw::net::default_host);
+	cw::pacer::shutdown();
+	cw::jobs::shutdown();
 	cw::sys::kill();
 	return 0;
 }
@@ -1,130 +1,395 @@
 #include "gpu.h"
 #include "sys.h"
 #include "misc.h"
+#include "cfg.h"
 #include "materials.h"
+#include "textures.h"
+#include "pack.h"
 
 #include <vector>
+#include <deque>
 #include <utility>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
 #include <stb_image.h>
 #include <iostream>
 #include <assert.h>
 #include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 #include <fmt/format.h>
 
 namespace cw::textures {
 
-	GLuint x256_array = 0;
-	GLuint x512_array = 0;
-	GLuint x1024_array = 0;
+	struct block {
+		int layer = -1;
+		glm::ivec2 position { 0, 0 };
+		int order = 0;
+	};
 
-	std::map<std::string, int> x256_indices;
-	std::map<std::string, int> x512_indices;
-	std::map<std::string, int> x1024_indices;
+	struct entry {
+		std::string name;
+		std::string path;
+		glm::ivec2 size { 0, 0 };
+		int tail_mip = 0;
+		int resident_mip = -1;
+		int pending_mip = -1;
+		block tail_block;
+		block stream_block;
+		uint64_t last_used_frame = 0;
+	};
+
+	struct decode_job {
+		uint32_t index = 0;
+		int mip = 0;
+	};
+
+	struct decoded_image {
+		uint32_t index = 0;
+		int mip = 0;
+		glm::ivec2 size { 0, 0 };
+		glm::ivec2 full_size { 0, 0 };
+		std::vector<unsigned char> pixels;
+	};
+
+	const int pool_gutter = 2;
+	const int pool_min_block_size = 32;
+	const int tail_size = 64;
+	const size_t upload_bytes_per_frame = 4 * 1024 * 1024;
+
+	GLuint pool_array = 0;
+	GLuint pool_transform_buffer = 0;
+	int pool_num_layers = 0;
+	int pool_num_orders = 0;
+	int texture_budget_mb = 128;
+	uint64_t current_frame = 0;
+	bool transforms_dirty = false;
+
+	std::vector<entry> entries;
+	std::vector<std::vector<block>> free_blocks;
+
+	std::thread decode_thread;
+	std::mutex decode_mutex;
+	std::condition_variable decode_condition;
+	std::deque<decode_job> decode_queue;
+	std::deque<decoded_image> decode_results;
+	bool decode_thread_quit = false;
 
 	void load_all();
 	void load_general();
+	void shutdown();
+	void update();
+	int order_for_size(int size);
+	int block_size(int order);
+	bool allocate_block(int order, block &result);
+	void free_block(block &target);
+	bool evict_least_recently_used(int order, uint32_t requesting_index);
+	void place(uint32_t index, const block &target, const glm::ivec2 &size);
+	void enqueue_decode(uint32_t index, int mip);
+	void decode_thread_main();
+	void downsample(std::vector<unsigned char> &pixels, glm::ivec2 &size);
 	void print_debug_info();
 }
 
+std::map<std::string, cw::textures::handle> cw::textures::registry;
+int cw::textures::pool_layer_size = 2048;
+
 void cw::textures::load_all() {
 	load_general();
 	print_debug_info();
 }
 
-void cw::textures::load_general() {
-	auto items = misc::map_file_names_and_extensions(sys::bin_path().string() + "texture\\object");
-	if (!items) return;
-	std::map<std::string, std::pair<std::vector<char>, glm::ivec2>> textures_256, textures_512, textures_1024;
-	for (auto &item : *items) {
-		auto texture_path = fmt::format("{}texture\\object\\{}.png", sys::bin_path().string(), item.first);
-		auto texture_file_contents = misc::read_file(texture_path);
-		if (!texture_file_contents) continue;
+int cw::textures::block_size(int order) {
+	return pool_min_block_size << order;
+}
+
+int cw::textures::order_for_size(int size) {
+	int order = 0;
+	while (block_size(order) < size) order++;
+	return order;
+}
+
+bool cw::textures::allocate_block(int order, block &result) {
+	if (order >= pool_num_orders) return false;
+	int available_order = order;
+	while (available_order < pool_num_orders && free_blocks[available_order].empty()) available_order++;
+	if (available_order >= pool_num_orders) return false;
+	block parent = free_blocks[available_order].back();
+	free_blocks[available_order].pop_back();
+	while (parent.order > order) {
+		parent.order--;
+		const int half = block_size(parent.order);
+		for (int i = 1; i < 4; i++) {
+			block sibling = parent;
+			sibling.position += glm::ivec2((i & 1) * half, (i >> 1) * half);
+			free_blocks[parent.order].push_back(sibling);
+		}
+	}
+	result = parent;
+	return true;
+}
+
+void cw::textures::free_block(block &target) {
+	if (target.layer < 0) return;
+	block merged = target;
+	target.layer = -1;
+	while (merged.order + 1 < pool_num_orders) {
+		const int parent_size = block_size(merged.order + 1);
+		const glm::ivec2 parent_position = (merged.position / parent_size) * parent_size;
+		auto &candidates = free_blocks[merged.order];
+		int num_buddies = 0;
+		for (auto &candidate : candidates) {
+			if (candidate.layer != merged.layer) continue;
+			if ((candidate.position / parent_size) * parent_size != parent_position) continue;
+			num_buddies++;
+		}
+		if (num_buddies < 3) break;
+		candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](const block &candidate) {
+			return candidate.layer == merged.layer && (candidate.position / parent_size) * parent_size == parent_position;
+		}), candidates.end());
+		merged.position = parent_position;
+		merged.order++;
+	}
+	free_blocks[merged.order].push_back(merged);
+}
+
+bool cw::textures::evict_least_recently_used(int order, uint32_t requesting_index) {
+	std::vector<uint32_t> candidates;
+	for (uint32_t i = 0; i < entries.size(); i++) {
+		if (i == requesting_index) continue;
+		if (entries[i].stream_block.layer < 0) continue;
+		if (entries[i].last_used_frame + 1 >= current_frame) continue;
+		candidates.push_back(i);
+	}
+	std::sort(candidates.begin(), candidates.end(), [](uint32_t a, uint32_t b) {
+		return entries[a].last_used_frame < entries[b].last_used_frame;
+	});
+	for (auto index : candidates) {
+		auto &victim = entries[index];
+		free_block(victim.stream_block);
+		victim.resident_mip = victim.tail_mip;
+		place(index, victim.tail_block, glm::ivec2(glm::max(victim.size.x >> victim.tail_mip, 1), glm::max(victim.size.y >> victim.tail_mip, 1)));
+		std::cout << "Evicted streamed mips of texture \"" << victim.name << "\"." << std::endl;
+		for (int i = order; i < pool_num_orders; i++) if (!free_blocks[i].empty()) return true;
+	}
+	return false;
+}
+
+void cw::textures::place(uint32_t index, const block &target, const glm::ivec2 &size) {
+	auto &placement = registry[entries[index].name];
+	placement.layer = static_cast<float>(target.layer);
+	placement.uv_scale = glm::vec2(size) / static_cast<float>(pool_layer_size);
+	placement.uv_offset = glm::vec2(target.position + glm::ivec2(pool_gutter)) / static_cast<float>(pool_layer_size);
+	transforms_dirty = true;
+}
+
+void cw::textures::enqueue_decode(uint32_t index, int mip) {
+	entries[index].pending_mip = mip;
+	{
+		std::lock_guard<std::mutex> lock(decode_mutex);
+		decode_queue.push_back({ index, mip });
+	}
+	decode_condition.notify_one();
+}
+
+void cw::textures::downsample(std::vector<unsigned char> &pixels, glm::ivec2 &size) {
+	const glm::ivec2 half_size = glm::max(size / 2, glm::ivec2(1));
+	std::vector<unsigned char> result(half_size.x * half_size.y * 3);
+	for (int y = 0; y < half_size.y; y++) {
+		for (int x = 0; x < half_size.x; x++) {
+			const int x0 = glm::min(x * 2, size.x - 1), x1 = glm::min(x * 2 + 1, size.x - 1);
+			const int y0 = glm::min(y * 2, size.y - 1), y1 = glm::min(y * 2 + 1, size.y - 1);
+			for (int c = 0; c < 3; c++) {
+				const int sum =
+					pixels[(y0 * size.x + x0) * 3 + c] + pixels[(y0 * size.x + x1) * 3 + c] +
+					pixels[(y1 * size.x + x0) * 3 + c] + pixels[(y1 * size.x + x1) * 3 + c];
+				result[(y * half_size.x + x) * 3 + c] = static_cast<unsigned char>(sum / 4);
+			}
+		}
+	}
+	pixels = std::move(result);
+	size = half_size;
+}
+
+void cw::textures::decode_thread_main() {
+	while (true) {
+		decode_job job;
+		std::string path;
+		{
+			std::unique_lock<std::mutex> lock(decode_mutex);
+			decode_condition.wait(lock, [] { return decode_thread_quit || !decode_queue.empty(); });
+			if (decode_thread_quit) return;
+			job = decode_queue.front();
+			decode_queue.pop_front();
+			path = entries[job.index].path;
+		}
+		auto file_contents = pack::open(path);
+		if (!file_contents) continue;
 		int w, h, channels;
 		unsigned char *image = stbi_load_from_memory(
-			reinterpret_cast<unsigned char *>(texture_file_contents->data()),
-			texture_file_contents->size(),
+			reinterpret_cast<const unsigned char *>(file_contents->data),
+			file_contents->size,
 			&w, &h, &channels, STBI_rgb
 		);
 		if (!image) {
-			std::cout << "Unable to recognize file \"" << texture_path << "\" as an image." << std::endl;
+			std::cout << "Unable to recognize file \"" << path << "\" as an image." << std::endl;
 			continue;
 		}
-		if (w == 256 && h == 256) {
-			textures_256[item.first].first.resize(w * h * 3);
-			textures_256[item.first].second = { w, h };
-			memcpy(textures_256[item.first].first.data(), image, w * h * 3);
-		} else if (w == 512 && h == 512) {
-			textures_512[item.first].first.resize(w * h * 3);
-			textures_512[item.first].second = { w, h };
-			memcpy(textures_512[item.first].first.data(), image, w * h * 3);
-		} else if (w == 1024 && h == 1024) {
-			textures_1024[item.first].first.resize(w * h * 3);
-			textures_1024[item.first].second = { w, h };
-			memcpy(textures_1024[item.first].first.data(), image, w * h * 3);
-		} else {
-			std::cout << "Texture within \"" << texture_path << "\" is an unsupported size. (" << w << " by " << h << ")" << std::endl;
+		if (job.mip < 0) {
+			job.mip = 0;
+			while (glm::max(w >> job.mip, h >> job.mip) > tail_size) job.mip++;
 		}
+		decoded_image result;
+		result.index = job.index;
+		result.mip = job.mip;
+		result.full_size = { w, h };
+		result.size = { w, h };
+		result.pixels.assign(image, image + w * h * 3);
 		stbi_image_free(image);
+		for (int i = 0; i < job.mip; i++) downsample(result.pixels, result.size);
+		std::lock_guard<std::mutex> lock(decode_mutex);
+		decode_results.push_back(std::move(result));
 	}
-	if (x256_array) glDeleteTextures(1, &x256_array);
-	if (x512_array) glDeleteTextures(1, &x512_array);
-	if (x1024_array) glDeleteTextures(1, &x1024_array);
-	glGenTextures(1, &x256_array);
-	assert(x256_array);
-	glGenTextures(1, &x512_array);
-	assert(x512_array);
-	glGenTextures(1, &x1024_array);
-	assert(x1024_array);
-	glBindTexture(GL_TEXTURE_2D_ARRAY, x256_array);
-	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, 256, 256, textures_256.size(), 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	GLint z_offset = 0;
-	for (auto &image : textures_256) {
-		glTexSubImage3D(
-			GL_TEXTURE_2D_ARRAY, 0, 0, 0,
-			z_offset, image.second.second.x, image.second.second.y, 1,
-			GL_RGB, GL_UNSIGNED_BYTE, image.second.first.data());
-		x256_indices[image.first] = z_offset;
-		z_offset++;
+}
+
+void cw::textures::load_general() {
+	shutdown();
+	auto &system_cfg = cfg["system"];
+	if (system_cfg.find("texture_budget_mb") == system_cfg.end()) system_cfg["texture_budget_mb"] = texture_budget_mb;
+	texture_budget_mb = system_cfg["texture_budget_mb"];
+	auto items = pack::map_file_names_and_extensions("texture/object");
+	if (!items) return;
+	GLint max_texture_size = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+	pool_layer_size = std::min(2048, static_cast<int>(max_texture_size));
+	pool_num_orders = order_for_size(pool_layer_size) + 1;
+	const size_t layer_bytes = static_cast<size_t>(pool_layer_size) * pool_layer_size * 4;
+	pool_num_layers = std::max<int>(1, static_cast<int>((static_cast<size_t>(texture_budget_mb) * 1024 * 1024) / layer_bytes));
+	free_blocks.assign(pool_num_orders, {});
+	for (int i = 0; i < pool_num_layers; i++) {
+		block root;
+		root.layer = i;
+		root.order = pool_num_orders - 1;
+		free_blocks[root.order].push_back(root);
 	}
-	glBindTexture(GL_TEXTURE_2D_ARRAY, x512_array);
-	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, 512, 512, textures_512.size(), 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+	glGenTextures(1, &pool_array);
+	assert(pool_array);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, pool_array);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, pool_layer_size, pool_layer_size, pool_num_layers, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	z_offset = 0;
-	for (auto &image : textures_512) {
-		glTexSubImage3D(
-			GL_TEXTURE_2D_ARRAY, 0, 0, 0,
-			z_offset, image.second.second.x, image.second.second.y, 1,
-			GL_RGB, GL_UNSIGNED_BYTE, image.second.first.data());
-		x512_indices[image.first] = z_offset;
-		z_offset++;
+	for (auto &item : *items) {
+		entry new_entry;
+		new_entry.name = item.first;
+		new_entry.path = fmt::format("texture/object/{}.png", item.first);
+		handle new_handle;
+		new_handle.index = static_cast<uint32_t>(entries.size() + 1);
+		registry[item.first] = new_handle;
+		entries.push_back(new_entry);
 	}
-	glBindTexture(GL_TEXTURE_2D_ARRAY, x1024_array);
-	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, 1024, 1024, textures_1024.size(), 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	z_offset = 0;
-	for (auto &image : textures_1024) {
+	glGenBuffers(1, &pool_transform_buffer);
+	assert(pool_transform_buffer);
+	transforms_dirty = true;
+	decode_thread_quit = false;
+	decode_thread = std::thread(decode_thread_main);
+	// Every texture starts with its smallest mip so something is on screen right away.
+	for (uint32_t i = 0; i < entries.size(); i++) enqueue_decode(i, -1);
+	std::cout << "Texture pool is " << pool_num_layers << " layers of " << pool_layer_size << " by " << pool_layer_size << ". (" << texture_budget_mb << " MB budget)" << std::endl;
+}
+
+void cw::textures::shutdown() {
+	if (decode_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(decode_mutex);
+			decode_thread_quit = true;
+		}
+		decode_condition.notify_all();
+		decode_thread.join();
+	}
+	decode_queue.clear();
+	decode_results.clear();
+	entries.clear();
+	free_blocks.clear();
+	registry.clear();
+	if (pool_array) glDeleteTextures(1, &pool_array);
+	if (pool_transform_buffer) glDeleteBuffers(1, &pool_transform_buffer);
+	pool_array = 0;
+	pool_transform_buffer = 0;
+}
+
+void cw::textures::request(uint32_t index, float screen_extent) {
+	if (!index || index > entries.size()) return;
+	auto &target = entries[index - 1];
+	target.last_used_frame = current_frame;
+	if (target.resident_mip < 0 || screen_extent <= 0) return;
+	const float largest_dimension = static_cast<float>(glm::max(target.size.x, target.size.y));
+	int desired_mip = static_cast<int>(std::floor(std::log2(glm::max(largest_dimension / screen_extent, 1.0f))));
+	desired_mip = glm::clamp(desired_mip, 0, target.tail_mip);
+	while (desired_mip < target.tail_mip && block_size(pool_num_orders - 1) < glm::max(target.size.x, target.size.y) / (1 << desired_mip) + pool_gutter * 2) desired_mip++;
+	if (desired_mip >= target.resident_mip) return;
+	if (target.pending_mip >= 0 && target.pending_mip <= desired_mip) return;
+	enqueue_decode(index - 1, desired_mip);
+}
+
+void cw::textures::update() {
+	current_frame++;
+	size_t uploaded_bytes = 0;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, pool_array);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	while (uploaded_bytes < upload_bytes_per_frame) {
+		decoded_image image;
+		{
+			std::lock_guard<std::mutex> lock(decode_mutex);
+			if (decode_results.empty()) break;
+			image = std::move(decode_results.front());
+			decode_results.pop_front();
+		}
+		auto &target = entries[image.index];
+		target.size = image.full_size;
+		target.tail_mip = 0;
+		// Sizes are only known once the worker has seen the image header.
+		while (glm::max(target.size.x >> target.tail_mip, target.size.y >> target.tail_mip) > tail_size) target.tail_mip++;
+		if (target.pending_mip == image.mip) target.pending_mip = -1;
+		if (target.resident_mip >= 0 && image.mip >= target.resident_mip) continue;
+		const int order = order_for_size(glm::max(image.size.x, image.size.y) + pool_gutter * 2);
+		block destination;
+		if (!allocate_block(order, destination)) {
+			if (!evict_least_recently_used(order, image.index) || !allocate_block(order, destination)) {
+				std::cout << "Texture pool is over budget; \"" << target.name << "\" stays at mip " << target.resident_mip << "." << std::endl;
+				continue;
+			}
+		}
 		glTexSubImage3D(
-			GL_TEXTURE_2D_ARRAY, 0, 0, 0,
-			z_offset, image.second.second.x, image.second.second.y, 1,
-			GL_RGB, GL_UNSIGNED_BYTE, image.second.first.data());
-		x512_indices[image.first] = z_offset;
-		z_offset++;
+			GL_TEXTURE_2D_ARRAY, 0, destination.position.x + pool_gutter, destination.position.y + pool_gutter,
+			destination.layer, image.size.x, image.size.y, 1,
+			GL_RGB, GL_UNSIGNED_BYTE, image.pixels.data());
+		uploaded_bytes += image.pixels.size();
+		if (image.mip == target.tail_mip) target.tail_block = destination;
+		else {
+			free_block(target.stream_block);
+			target.stream_block = destination;
+		}
+		target.resident_mip = image.mip;
+		place(image.index, destination, image.size);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (!transforms_dirty) return;
+	std::vector<glm::vec4> transforms((entries.size() + 1) * 2, glm::vec4(-1, 0, 0, 0));
+	for (auto &pair : registry) {
+		transforms[pair.second.index * 2] = glm::vec4(pair.second.uv_scale, pair.second.uv_offset);
+		transforms[pair.second.index * 2 + 1] = glm::vec4(pair.second.layer, entries[pair.second.index - 1].resident_mip, 0, 0);
 	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, pool_transform_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, transforms.size() * sizeof(glm::vec4), transforms.data(), GL_DYNAMIC_DRAW);
+	transforms_dirty = false;
 }
 
 void cw::textures::print_debug_info() {
-	std::cout << "Loaded " << x256_indices.size() << " x256, " << x512_indices.size() << " x512, " << x1024_indices.size() << " x1024 textures." << std::endl;
-	for (auto &e : x256_indices) std::cout << " x256[" << e.second << "] <- " << e.first << std::endl;
-	for (auto &e : x512_indices) std::cout << " x512[" << e.second << "] <- " << e.first << std::endl;
-	for (auto &e : x1024_indices) std::cout << " x1024[" << e.second << "] <- " << e.first << std::endl;
+	std::cout << "Registered " << registry.size() << " streamed textures." << std::endl;
+	for (auto &e : registry) std::cout << " pool[" << e.second.index << "] <- " << e.first << std::endl;
 }
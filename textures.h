@@ -1,9 +1,18 @@
 #pragma once
 
+#include <cstdint>
 #include <map>
 #include <string>
+#include <glm/vec2.hpp>
 
 namespace cw::textures {
-	extern std::map<std::string, int> x256_indices;
-	extern std::map<std::string, int> x512_indices;
+	struct handle {
+		uint32_t index = 0;
+		float layer = -1;
+		glm::vec2 uv_scale { 1, 1 };
+		glm::vec2 uv_offset { 0, 0 };
+	};
+	extern std::map<std::string, handle> registry;
+	extern int pool_layer_size;
+	void request(uint32_t index, float screen_extent);
 }
@@ -3,8 +3,10 @@
 #include "gpu.h"
 #include "pov.h"
 #include "materials.h"
+#include "textures.h"
 #include "scene.h"
 #include "local_player.h"
+#include "projectiles.h"
 
 #include <algorithm>
 #include <glm/matrix.hpp>
@@ -12,18 +14,63 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/vec3.hpp>
 
+namespace cw::core {
+	extern characters::set characters;
+	extern projectiles::pool projectiles;
+}
+
+namespace cw::local_player {
+	extern bool fire_input;
+	extern glm::vec3 aim_origin;
+	extern glm::vec3 aim_direction;
+}
+
 namespace cw::weapon {
 	auto hud_node = std::make_shared<node>();
+	float cooldown = 0;
+	float fire_interval(id weapon);
+	void on_fixed_step(const double &delta);
+	void apply_impacts();
 	void update(const double &delta);
 	void render_local_player_hud_model();
 }
 
 cw::weapon::id cw::weapon::local_player_equipped = cw::weapon::id::null;
 
+float cw::weapon::fire_interval(id weapon) {
+	if (weapon == id::personal_defense_gun) return 1.0f / 15;
+	if (weapon == id::grenade_launcher) return 0.8f;
+	return 0;
+}
+
+void cw::weapon::on_fixed_step(const double &delta) {
+	cooldown = glm::max(cooldown - static_cast<float>(delta), -static_cast<float>(delta));
+	if (local_player_equipped != id::null && local_player::fire_input) {
+		const auto character = local_player::character;
+		// Carrying the negative remainder over keeps automatic fire on its cadence between fixed steps.
+		while (cooldown <= 0) {
+			projectiles::spawn(core::projectiles, local_player_equipped, local_player::aim_origin + local_player::aim_direction * 0.5f, local_player::aim_direction, core::characters.velocity[character], core::characters.object[character]);
+			cooldown += fire_interval(local_player_equipped);
+		}
+	}
+	projectiles::step(core::projectiles, physics::dynamics_world, delta);
+	apply_impacts();
+}
+
+void cw::weapon::apply_impacts() {
+	for (auto &impact : core::projectiles.impacts) {
+		auto body = btRigidBody::upcast(const_cast<btCollisionObject *>(impact.object));
+		if (!body || body->isStaticOrKinematicObject()) continue;
+		const float impulse = projectiles::ballistics_for(impact.weapon).impulse;
+		body->activate();
+		body->applyImpulse(physics::to(glm::normalize(impact.velocity) * impulse), physics::to(impact.point) - body->getCenterOfMassPosition());
+	}
+}
+
 void cw::weapon::update(const double &delta) {
 	static float bob_x = 0.0f;
 	auto default_gun_location = glm::vec3(0.45f, 0.7f, -0.4f);
-	auto local_player_velocity = physics::from(local_player::rigid_body->getLinearVelocity());
+	auto local_player_velocity = core::characters.velocity[local_player::character];
 	bob_x += glm::max(delta * glm::min(glm::length(glm::fvec3(local_player_velocity.x, local_player_velocity.y, 0)), 1.0f) * 700.0f, delta * 200.0);
 	glm::fvec3 local_player_velocity_offset = local_player_velocity * local_player::camera_proxy->orientation * -0.002f;
 	auto bob_offset = glm::fvec3(0.0f, 0.0f, sinf(glm::radians(bob_x))) * 0.01f * glm::min(glm::length(local_player_velocity), 1.0f);
@@ -47,11 +94,12 @@ void cw::weapon::render_local_player_hud_model() {
 	glUseProgram(program);
 	glUniformMatrix4fv(glGetUniformLocation(program, "world_transform"), 1, GL_FALSE, glm::value_ptr(model));
 	glUniformMatrix4fv(glGetUniformLocation(program, "total_transform"), 1, GL_FALSE, glm::value_ptr(total_transform));
+	glBindVertexArray(prop.array);
 	for (auto &part : prop.parts) {
-		glBindVertexArray(part.array);
-		glBindBuffer(GL_ARRAY_BUFFER, part.buffer);
-		float material_id = static_cast<size_t>(std::distance(materials::registry.begin(), materials::registry.find(part.material_name)));
-		glUniform2f(glGetUniformLocation(program, "material_identifier"), 0, material_id);
-		glDrawArrays(GL_TRIANGLES, 0, part.num_vertices);
+		const auto material = materials::identifier(part.material_name);
+		if (!material) continue;
+		textures::request(static_cast<uint32_t>(material->x), gpu::render_target_size.y);
+		glUniform2f(glGetUniformLocation(program, "material_identifier"), material->x, material->y);
+		glDrawElementsBaseVertex(GL_TRIANGLES, part.num_indices, GL_UNSIGNED_INT, reinterpret_cast<void *>(sizeof(uint32_t) * part.first_index), part.base_vertex);
 	}
 }